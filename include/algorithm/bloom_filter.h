@@ -0,0 +1,49 @@
+#ifndef INSOMNIA_BLOOM_FILTER_H
+#define INSOMNIA_BLOOM_FILTER_H
+
+#include <algorithm>
+#include <fstream>
+#include <filesystem>
+#include "vector.h"
+#include "algorithm.h"
+
+namespace insomnia {
+
+// Bloom filter over key hashes, telling "surely absent" without visiting the index.
+// It is sized for capacity keys at bits_per_key bits each; past that the false positive rate
+// climbs, and overfull() asks the owner to rebuild it. Removed keys stay until a rebuild.
+// Held in memory. save() writes it to a file and load() reads it back and removes the file,
+// so that a filter is only read back after a clean shutdown of its owner.
+class BloomFilter {
+public:
+  explicit BloomFilter(size_t bits_per_key = 10);
+
+  // forgets all keys and makes room for capacity of them.
+  void reset(size_t capacity);
+  void insert(hash_result_t hash);
+  // false only if hash was not inserted since the last reset.
+  bool may_contain(hash_result_t hash) const;
+
+  bool overfull() const { return key_cnt_ > capacity_; }
+  size_t key_count() const { return key_cnt_; }
+  size_t capacity() const { return capacity_; }
+
+  void save(const std::filesystem::path &path) const;
+  // returns false (and keeps the filter as is) if there is no file saved with this bits_per_key.
+  bool load(const std::filesystem::path &path);
+
+private:
+  // probe i is h1 + i * h2 over the bit array, both halves of one mixed hash.
+  static hash_result_t mix(hash_result_t x);
+
+  size_t bits_per_key_;
+  int probe_cnt_;
+  size_t bit_cnt_;
+  size_t key_cnt_;
+  size_t capacity_;
+  vector<uint64_t> words_;
+};
+
+}
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef INSOMNIA_RANGE_KERNELS_H
+#define INSOMNIA_RANGE_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace insomnia {
+
+// Kernels over runs of int32_t, e.g. per-segment counters.
+// On x86 CPUs with AVX2 (checked once at runtime) they go 8 lanes at a time: a masked load or
+// store covers the part before the first 32-byte boundary and the part after the last one,
+// the rest uses aligned vectors. Elsewhere they are plain loops.
+
+// the minimum of data[0, n). INT32_MAX if n == 0.
+int32_t range_min(const int32_t *data, size_t n);
+
+// adds delta to each of data[0, n).
+void range_add(int32_t *data, size_t n, int32_t delta);
+
+}
+
+#endif
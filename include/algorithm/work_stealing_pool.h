@@ -0,0 +1,68 @@
+#ifndef INSOMNIA_WORK_STEALING_POOL_H
+#define INSOMNIA_WORK_STEALING_POOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include "vector.h"
+
+namespace insomnia {
+
+// A fixed set of threads running batches of independent tasks 0 .. task_cnt - 1.
+// A batch is dealt out as one contiguous range of tasks per worker. A worker takes tasks from
+// the front of its own range, and once that is empty, steals the back half of the next range
+// with tasks left, so that uneven tasks even out.
+// The calling thread works as worker 0: a pool of worker_cnt workers keeps worker_cnt - 1
+// threads, asleep between batches.
+class WorkStealingPool {
+public:
+  explicit WorkStealingPool(size_t worker_cnt);
+  ~WorkStealingPool();
+  WorkStealingPool(const WorkStealingPool &) = delete;
+  WorkStealingPool& operator=(const WorkStealingPool &) = delete;
+
+  size_t worker_count() const { return worker_cnt_; }
+
+  // calls fn(worker, task) once for every task, concurrently across workers, and returns when
+  // all are done. The first exception thrown by fn is rethrown here after the batch.
+  // fn must not run a batch on this pool itself.
+  template <class Func>
+  void run(size_t task_cnt, Func &&fn);
+
+private:
+  struct TaskRange {
+    std::mutex latch;
+    size_t beg = 0, end = 0;
+  };
+  using task_fn_t = void (*)(void *ctx, size_t worker, size_t task);
+
+  void run_batch(size_t task_cnt, task_fn_t call, void *ctx);
+  void thread_loop(size_t worker);
+  // runs tasks on worker until none is left to take.
+  void work(size_t worker);
+  // the next task of worker, stolen if its own range is empty. false if none is left.
+  bool next_task(size_t worker, size_t &task);
+
+  const size_t worker_cnt_;
+  std::unique_ptr<TaskRange[]> ranges_; // one per worker
+  vector<std::thread> threads_;
+
+  // the batch, under batch_latch_.
+  std::mutex batch_latch_;
+  std::condition_variable batch_cv_; // a batch starts, or the pool stops
+  std::condition_variable done_cv_;  // the threads are done with the batch
+  size_t generation_ = 0;
+  size_t busy_cnt_ = 0;
+  bool stopping_ = false;
+  task_fn_t call_ = nullptr;
+  void *ctx_ = nullptr;
+  std::exception_ptr error_;
+};
+
+}
+
+#include "work_stealing_pool.tcc"
+
+#endif
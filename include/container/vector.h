@@ -282,6 +282,7 @@ public:
   void resize(size_t size) requires std::is_default_constructible_v<T>;
   void resize(size_t size, const T &t) requires std::is_copy_constructible_v<T>;
   T* data();
+  const T* data() const;
 
 private:
   T *_beg, *_end, *_lim;
@@ -1,24 +1,40 @@
 #ifndef INSOMNIA_BPLUSTREE_H
 #define INSOMNIA_BPLUSTREE_H
 
+#include <thread>
+#include <mutex>
+#include <exception>
+#include <type_traits>
 #include "optional.h"
+#include "bloom_filter.h"
 #include "buffer_pool.h"
 #include "bplustree_nodes.h"
 
 namespace insomnia {
 
-template <class KeyT, class ValueT, class KeyCompare = std::less<KeyT>>
+template <class KeyT, class ValueT, class KeyCompare = std::less<KeyT>, class LeafT = BptLeafNode<KeyT, ValueT>>
 class Bplustree {
 
   using Base = BptNodeBase;
-  using Internal = BptInternalNode<KeyT>;
-  using Leaf = BptLeafNode<KeyT, ValueT>;
-  using BufferType = BufferPool<Base, page_id_t, std::max(sizeof(Internal), sizeof(Leaf))>;
+  using Leaf = LeafT;
+  // the page size comes with the leaf type, e.g. BptLeafNode<KeyT, ValueT, 16384>.
+  using Internal = BptInternalNode<KeyT, Leaf::PAGE_SIZE>;
+  using BufferType = BufferPool<Base, page_id_t, std::max(sizeof(Internal), sizeof(Leaf)), Leaf::PAGE_SIZE>;
   using Visitor = typename BufferType::Visitor;
+  // const KeyT& for plain leaves, KeyT for leaves that decode their keys.
+  using KeyRef = decltype(std::declval<const Leaf&>().key(0));
+
+  static constexpr bool HASHABLE_KEY = std::is_invocable_r_v<hash_result_t, const hash<KeyT>&, const KeyT&>;
 
 public:
 
   Bplustree(const std::filesystem::path &path, int buffer_capacity, int replacer_k_arg);
+  // filter_bits_per_key > 0 keeps a Bloom filter of the keys next to the tree, so that find,
+  // search and remove of an absent key mostly skip the descent. Only for keys with an
+  // insomnia::hash. It takes the inserted keys, is rebuilt when it outgrows its size or a
+  // compaction pass ends, and is saved on destruction.
+  Bplustree(const std::filesystem::path &path, int buffer_capacity, int replacer_k_arg,
+            size_t filter_bits_per_key) requires (HASHABLE_KEY);
 
   ~Bplustree();
 
@@ -30,14 +46,44 @@ public:
 
   bool remove(const KeyT &key);
 
+  // removes the entries with lo <= key <= hi. The leaves strictly inside the range are
+  // freed with their pages unread and the boundary leaves are cut in place; the nodes left
+  // underfull are rebalanced once at the end instead of after every key.
+  void remove_range(const KeyT &lo, const KeyT &hi);
+
   void clear() {
+    pinned_.clear();
+    pinned_cnt_ = 0;
     buf_pool_.clear();
     root_ptr_ = NULL_PAGE_ID;
+    compact_phase_ = CompactPhase::Idle;
+    filter_.reset(0);
   }
 
+  // keeps up to frame_budget internal nodes pinned as they are visited, so that
+  // descents only go through the page table for leaves. 0 releases them all.
+  void pin_internal_levels(int frame_budget);
+
+  // walks every node once: level sizes and fill factors, page usage and leaf chain layout.
+  BptStats stats();
+
+  // one throttled step of online compaction, meant to run between commands.
+  // A pass walks the leaves in key order, merging each with the right siblings it can hold
+  // and moving it to the next page from the file head on; the internal nodes follow the
+  // leaves, and the file is cut after the last live page. A step handles about budget leaves,
+  // the internal nodes are moved in the last one at once.
+  // Returns true when a pass is finished; the next call starts another.
+  // No iterator may be held across a step.
+  bool compact_step(size_t budget);
+
   [[nodiscard]]
   bool empty() const { return root_ptr_ == NULL_PAGE_ID; }
 
+  // pages written back to disk so far.
+  size_t page_write_count() const { return buf_pool_.page_write_count(); }
+  // page before-images kept for the open snapshots.
+  size_t before_image_count() const { return buf_pool_.before_image_count(); }
+
   class iterator {
     friend Bplustree;
 
@@ -52,20 +98,20 @@ public:
       pos_ = 0;
     }
 
-    pair<const KeyT&, ValueT&> operator*() {
+    pair<KeyRef, ValueT&> operator*() {
       if(!visitor_.is_valid()) throw invalid_iterator("invalid bpt iterator");
       const auto ptr = visitor_.template as_mut<Leaf>();
-      return insomnia::make_pair(std::ref(ptr->key(pos_)), std::ref(ptr->value(pos_))); // ADL problems
+      return pair<KeyRef, ValueT&>(ptr->key(pos_), ptr->value(pos_));
     }
-    pair<const KeyT&, const ValueT&> operator*() const {
+    pair<KeyRef, const ValueT&> operator*() const {
       if(!visitor_.is_valid()) throw invalid_iterator("invalid bpt iterator");
       auto ptr = visitor_.template as<Leaf>();
-      return insomnia::make_pair(std::ref(ptr->key(pos_)), std::ref(ptr->value(pos_)));
+      return pair<KeyRef, const ValueT&>(ptr->key(pos_), ptr->value(pos_));
     }
-    pair<const KeyT&, const ValueT&> view() const {
+    pair<KeyRef, const ValueT&> view() const {
       if(!visitor_.is_valid()) throw invalid_iterator("invalid bpt iterator");
       auto ptr = visitor_.template as<Leaf>();
-      return insomnia::make_pair(std::ref(ptr->key(pos_)), std::ref(ptr->value(pos_)));
+      return pair<KeyRef, const ValueT&>(ptr->key(pos_), ptr->value(pos_));
     }
 
     iterator& operator++();
@@ -98,6 +144,60 @@ public:
   // the first that holds a key not lower than given key.
   iterator find_upper(const KeyT &key);
 
+  // visits the entries with lo <= key <= hi in order. pred(key, value) is evaluated in place
+  // on the leaf; visit(key, value) is called on the matching ones with a mutable value
+  // (only then is the leaf marked dirty). Stops after limit matches. Returns the match count.
+  template <class Pred, class Visit>
+  size_t scan(const KeyT &lo, const KeyT &hi, Pred &&pred, size_t limit, Visit &&visit);
+  // copies of the matching entries.
+  template <class Pred>
+  vector<pair<KeyT, ValueT>> scan(const KeyT &lo, const KeyT &hi, Pred &&pred, size_t limit = SIZE_MAX);
+
+  // calls fn(part, key, value) on every entry. The leaves are cut at internal node separators
+  // into up to part_cnt runs of neighbouring leaves, each walked in key order by a thread of its
+  // own; part is the index of the run, in key order. fn is called concurrently across parts.
+  // The workers pin one leaf each, so part_cnt has to stay below the free frames of the pool;
+  // they take a latch around the buffer pool for it.
+  // The tree must not be written meanwhile. Returns the number of parts.
+  template <class Func>
+  size_t parallel_scan(size_t part_cnt, Func &&fn);
+
+  // a read view of the tree as it was when taken. Writes may go on meanwhile: the pages they
+  // touch are read from before-images, see BufferPool::open_snapshot.
+  // Compaction pauses and clear() is refused while any view is held.
+  class snapshot {
+    friend Bplustree;
+
+  public:
+    snapshot() = default;
+    snapshot(const snapshot &) = delete;
+    snapshot& operator=(const snapshot &) = delete;
+    snapshot(snapshot &&other) noexcept { *this = std::move(other); }
+    snapshot& operator=(snapshot &&other) noexcept;
+    ~snapshot() { release(); }
+
+    bool is_valid() const { return tree_ != nullptr; }
+    void release();
+
+    optional<ValueT> search(const KeyT &key) const;
+    // as Bplustree::scan, with visit(key, value) given a const value.
+    template <class Pred, class Visit>
+    size_t scan(const KeyT &lo, const KeyT &hi, Pred &&pred, size_t limit, Visit &&visit) const;
+
+  private:
+    snapshot(Bplustree *tree, epoch_t epoch, page_id_t root_ptr)
+      : tree_(tree), epoch_(epoch), root_ptr_(root_ptr) {}
+
+    // the leaf that may hold key, pinned through holder if it is a live page.
+    const Leaf* leaf_of(const KeyT &key, Visitor &holder) const;
+
+    Bplustree *tree_ = nullptr;
+    epoch_t epoch_ = 0;
+    page_id_t root_ptr_ = NULL_PAGE_ID;
+  };
+
+  snapshot take_snapshot() { return snapshot(this, buf_pool_.open_snapshot(), root_ptr_); }
+
 private:
 
   bool key_equal(const KeyT &k1, const KeyT &k2) const {
@@ -108,11 +208,71 @@ private:
     return !value_compare_(v1, v2) && !value_compare_(v2, v1);
   }
 
+  static hash_result_t digest(const KeyT &key) {
+    if constexpr(HASHABLE_KEY) return hash<KeyT>()(key);
+    else return 0;
+  }
+  // true if the filter tells that key is not in the tree.
+  bool surely_absent(const KeyT &key) const {
+    return filter_bits_ > 0 && !filter_.may_contain(digest(key));
+  }
+  // adds key to the filter (and the one a compaction pass builds), rebuilding it first if full.
+  void filter_insert(const KeyT &key);
+  // refills the filter from the leaves, sized for twice the keys there.
+  void rebuild_filter();
+
+  Visitor node_visitor(page_id_t page_id);
+  void dealloc_node(page_id_t page_id);
+
+  // goes down from the root through node->child(locate(node)) until depth nodes are
+  // on the path or a leaf is reached. path_pos holds the child positions taken.
+  template <class Locate>
+  void descend(vector<Visitor> &visitors, vector<int> &path_pos, Locate &&locate, size_t depth = SIZE_MAX);
+  // coalesces the too small node visitors.back() with a sibling or borrows from it.
+  // visitors is its path from the root; visitors.back() may be dropped.
+  void rebalance(vector<Visitor> &visitors, const vector<int> &path_pos);
+  template <class Node>
+  void rebalance_with_sibling(Visitor &visitor, Internal *parent_node, int pos);
+  // drops the roots that are empty leaves or have a single child.
+  void shrink_root();
+  // frees the pages of a subtree that has levels internal levels, without reading its leaves.
+  void free_subtree(page_id_t page_id, int levels);
+
+  // the path (node, child position) from the root down to the live node on page_id, which
+  // is not on it. Returns false if page_id is not reachable.
+  bool locate_node(page_id_t page_id, vector<pair<page_id_t, int>> &trail);
+  // moves the node on page from to the free page to, fixing its parent (or root_ptr_) and,
+  // for a leaf, the rht_ptr of its left neighbour. Returns false if from holds no live node.
+  bool move_node(page_id_t from, page_id_t to);
+  // moves the node on page_id to target, first moving away the node living there.
+  // Returns where that one went, NULL_PAGE_ID if target held none.
+  page_id_t place_node(page_id_t page_id, page_id_t target);
+  // places the leaf under the compaction cursor after merging its right siblings into it.
+  // Returns the leaves handled.
+  size_t compact_leaf();
+  // places the internal nodes after the leaves and truncates the file.
+  void compact_internals();
+
+  enum class CompactPhase { Idle, Leaves, Internals };
+
   BufferType buf_pool_;
+  vector<Visitor> pinned_; // indexed by page id
+  int pin_budget_ = 0, pinned_cnt_ = 0;
   page_id_t root_ptr_;
   KeyCompare key_compare_;
+  CompactPhase compact_phase_ = CompactPhase::Idle;
+  KeyT compact_key_ {}; // the first key of the next leaf to place
+  page_id_t compact_target_ = NULL_PAGE_ID; // where the next node goes
+  const size_t filter_bits_; // 0 if the filter is off
+  const std::filesystem::path filter_path_;
+  BloomFilter filter_;
+  BloomFilter compact_filter_; // the keys of the leaves placed in this pass and the inserted ones
 };
 
+// B+ tree with prefix-truncated leaves, see BptPrefixLeafNode.
+template <class KeyT, class ValueT, class KeyCompare = std::less<KeyT>>
+using PrefixBplustree = Bplustree<KeyT, ValueT, KeyCompare, BptPrefixLeafNode<KeyT, ValueT>>;
+
 }
 
 #include "bplustree.tcc"
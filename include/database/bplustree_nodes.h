@@ -2,11 +2,22 @@
 #define INSOMNIA_MULTI_BPLUSTREE_NODES_H
 
 #include "fstream.h"
+#include "key_codec.h"
 
 namespace insomnia {
 
 inline constexpr size_t NODE_CAPACITY_LIM = 4;
 
+constexpr size_t AlignedSize(size_t size, size_t align) {
+  return (size + align - 1) / align * align;
+}
+
+// entries of entry_size that fit into the pages of a node after header_size bytes of header.
+constexpr size_t NodeCapacity(size_t header_size, size_t entry_size, size_t page_size) {
+  return std::max(NODE_CAPACITY_LIM,
+    (SectorAlignedSize(header_size + entry_size, page_size) - header_size) / entry_size);
+}
+
 class BptNodeBase {
 public:
 
@@ -24,6 +35,8 @@ public:
 
   bool too_small() const { return size() < min_size(); }
 
+  bool can_coalesce(const BptNodeBase *rht) const { return size() + rht->size() <= merge_bound(); }
+
 protected:
 
   enum class NodeT { Invalid, Internal, Leaf };
@@ -33,19 +46,93 @@ protected:
   int size_;
 };
 
-template <class KeyT, class ValueT>
+// shape of a B+ tree on disk, see Bplustree::stats.
+struct BptStats {
+  struct Level {
+    size_t nodes = 0;
+    size_t entries = 0;
+    double avg_fill = 0; // size / max_size, averaged over the nodes.
+    double min_fill = 0;
+  };
+
+  vector<Level> levels; // from the root down, the last one holds the leaves.
+  size_t allocated_pages = 0;
+  size_t free_pages = 0;
+  size_t unreachable_pages = 0; // allocated, but neither free nor reached from the root.
+  size_t leaf_jumps = 0; // leaf chain links to another page than the next one in the file.
+  double avg_leaf_distance = 0; // mean |page id difference| over the leaf chain links.
+  size_t broken_links = 0; // rht_ptr not pointing to the next leaf of the level.
+
+  int height() const { return levels.size(); }
+
+  void add_node(size_t level, const BptNodeBase *node) {
+    if(level == levels.size())
+      levels.push_back(Level());
+    auto &lvl = levels[level];
+    double fill = node->max_size() > 0 ? double(node->size()) / node->max_size() : 0;
+    lvl.avg_fill = (lvl.avg_fill * lvl.nodes + fill) / (lvl.nodes + 1);
+    lvl.min_fill = lvl.nodes == 0 ? fill : std::min(lvl.min_fill, fill);
+    ++lvl.nodes;
+    lvl.entries += node->size();
+  }
+
+  // leaves are the page ids of the leaf level from left to right,
+  // rht_ptrs what each of them links to.
+  void add_leaf_chain(const vector<page_id_t> &leaves, const vector<page_id_t> &rht_ptrs) {
+    size_t distance_sum = 0;
+    for(size_t i = 0; i + 1 < leaves.size(); ++i) {
+      if(rht_ptrs[i] != leaves[i + 1])
+        ++broken_links;
+      if(leaves[i + 1] != leaves[i] + 1)
+        ++leaf_jumps;
+      distance_sum += std::abs(leaves[i + 1] - leaves[i]);
+    }
+    if(!leaves.empty() && rht_ptrs.back() != NULL_PAGE_ID)
+      ++broken_links;
+    avg_leaf_distance = leaves.size() > 1 ? double(distance_sum) / (leaves.size() - 1) : 0;
+  }
+
+  void add_pages(size_t max_page_id, size_t free_page_cnt) {
+    size_t reached = 0;
+    for(const auto &lvl : levels)
+      reached += lvl.nodes;
+    allocated_pages = max_page_id - free_page_cnt;
+    free_pages = free_page_cnt;
+    unreachable_pages = allocated_pages > reached ? allocated_pages - reached : 0;
+  }
+
+  friend std::ostream& operator<<(std::ostream &os, const BptStats &stats) {
+    os << "height " << stats.height() << '\n';
+    for(int i = 0; i < stats.height(); ++i) {
+      const auto &lvl = stats.levels[i];
+      os << "  level " << i << ": " << lvl.nodes << " nodes, " << lvl.entries << " entries, fill avg "
+         << lvl.avg_fill << " min " << lvl.min_fill << '\n';
+    }
+    os << "pages: " << stats.allocated_pages << " allocated, " << stats.free_pages << " free, "
+       << stats.unreachable_pages << " unreachable\n"
+       << "leaf chain: " << stats.leaf_jumps << " jumps, avg distance " << stats.avg_leaf_distance
+       << ", " << stats.broken_links << " broken links\n";
+    return os;
+  }
+};
+
+// Nodes are laid out to fill pages of page_size bytes, see BufferPool.
+template <class KeyT, class ValueT, size_t page_size = SECTOR_SIZE>
 class MultiBptInternalNode : public BptNodeBase {
   struct Storage {
     KeyT key;
     ValueT value;
     page_id_t child;
+    size_t count; // entries in the subtree of child
   };
 
-  static constexpr size_t CAPACITY = std::max(NODE_CAPACITY_LIM,
-    SectorAlignedSize(sizeof(Storage)) / sizeof(Storage));
+  static constexpr size_t CAPACITY = NodeCapacity(
+    AlignedSize(sizeof(BptNodeBase), alignof(Storage)), sizeof(Storage), page_size);
 
 public:
 
+  static constexpr size_t PAGE_SIZE = page_size;
+
   void init(int max_size = CAPACITY - 1);
 
   template <class KVCompare>
@@ -54,7 +141,7 @@ public:
   template <class KeyCompare>
   int locate_key(const KeyT &key, KeyCompare key_compare) const;
 
-  void insert(int pos, const KeyT &key, const ValueT &value, page_id_t child);
+  void insert(int pos, const KeyT &key, const ValueT &value, page_id_t child, size_t count);
 
   void remove(int pos);
 
@@ -74,22 +161,29 @@ public:
   ValueT& value(int pos) { return storage_[pos].value; }
   const ValueT& value(int pos) const { return storage_[pos].value; }
   page_id_t child(int pos) const { return storage_[pos].child; }
+  void set_child(int pos, page_id_t child) { storage_[pos].child = child; }
+  size_t count(int pos) const { return storage_[pos].count; }
+  void set_count(int pos, size_t count) { storage_[pos].count = count; }
+  size_t total() const;
 
 private:
   Storage storage_[CAPACITY];
 };
 
-template <class KeyT, class ValueT>
+template <class KeyT, class ValueT, size_t page_size = SECTOR_SIZE>
 class BptLeafNode : public BptNodeBase {
   struct Storage {
     KeyT key;
     ValueT value;
   };
-  static constexpr size_t CAPACITY = std::max(NODE_CAPACITY_LIM,
-    (SectorAlignedSize(sizeof(Storage) + sizeof(page_id_t)) - sizeof(page_id_t)) / sizeof(Storage));
+  static constexpr size_t CAPACITY = NodeCapacity(
+    AlignedSize(sizeof(BptNodeBase), alignof(Storage)) + AlignedSize(sizeof(page_id_t), alignof(Storage)),
+    sizeof(Storage), page_size);
 
 public:
 
+  static constexpr size_t PAGE_SIZE = page_size;
+
   void init(int max_size = CAPACITY - 1);
 
   template <class KVCompare>
@@ -103,6 +197,9 @@ public:
 
   void remove(int pos);
 
+  // removes the entries in [first, last).
+  void remove(int first, int last);
+
   void split(BptLeafNode *rht, page_id_t rht_ptr);
 
   void coalesce(BptLeafNode *rht);
@@ -117,13 +214,128 @@ public:
   ValueT& value(int pos) { return storage_[pos].value; }
   const ValueT& value(int pos) const { return storage_[pos].value; }
   page_id_t rht_ptr() const { return rht_ptr_; }
+  void set_rht_ptr(page_id_t rht_ptr) { rht_ptr_ = rht_ptr; }
+  // plain leaves keep no fences.
+  void set_hi_fence(const KeyT &) {}
+  // a leaf that is not too large always takes one more entry.
+  bool fits(const KeyT &) const { return true; }
 
 private:
   Storage storage_[CAPACITY];
   page_id_t rht_ptr_ {};
 };
 
-template <class KeyT>
+// Leaf whose keys are stored as KeyCodec bytes with the prefix shared by its fence keys
+// (the separators bounding it in the parent) cut off. Values and key suffixes live in two
+// arrays so that values stay aligned; the suffix length, and with it the capacity, is fixed
+// per node and recomputed whenever the fences change.
+// The byte order of KeyCodec<KeyT> must agree with the KeyCompare of the tree.
+template <class KeyT, class ValueT, size_t page_size = SECTOR_SIZE> requires KeyEncodable<KeyT>
+class BptPrefixLeafNode : public BptNodeBase {
+  using Codec = KeyCodec<KeyT>;
+
+  static constexpr int KEY_SIZE = Codec::SIZE;
+  static constexpr size_t DATA_ALIGN = std::max(alignof(ValueT), alignof(page_id_t));
+  static constexpr size_t NODE_SIZE = SectorAlignedSize(
+    sizeof(BptNodeBase) + sizeof(page_id_t) + 4 + 2 * KEY_SIZE + DATA_ALIGN +
+    NODE_CAPACITY_LIM * (KEY_SIZE + sizeof(ValueT)), page_size);
+  static constexpr size_t HEADER_SIZE =
+    (sizeof(BptNodeBase) + sizeof(page_id_t) + 4 + 2 * KEY_SIZE + DATA_ALIGN - 1) / DATA_ALIGN * DATA_ALIGN;
+  static constexpr size_t DATA_SIZE = NODE_SIZE - HEADER_SIZE;
+  static constexpr int BASE_CAPACITY = DATA_SIZE / (KEY_SIZE + sizeof(ValueT));
+  // capacity never grows beyond 5/4 of the uncompressed one, so that half of a full node
+  // always fits into a node with any other prefix and rebalancing cannot run out of room.
+  static constexpr int CAPACITY_LIM = BASE_CAPACITY + BASE_CAPACITY / 4;
+
+public:
+
+  static constexpr size_t PAGE_SIZE = page_size;
+
+  void init();
+
+  template <class KVCompare>
+  int locate_pair(const KeyT &key, const ValueT &value, KVCompare kv_compare) const;
+
+  // returns size() if key too large.
+  template <class KeyCompare>
+  int locate_key(const KeyT &key, KeyCompare key_compare) const;
+
+  // a key out of the fences widens the one on its side, and the leaf takes the shorter prefix.
+  void insert(int pos, const KeyT &key, const ValueT &value);
+
+  // whether key can be inserted before a split: one out of the fences may cut the capacity.
+  bool fits(const KeyT &key) const;
+
+  void remove(int pos);
+
+  // removes the entries in [first, last).
+  void remove(int first, int last);
+
+  void split(BptPrefixLeafNode *rht, page_id_t rht_ptr);
+
+  // the merged node may get a shorter prefix, hence a smaller capacity.
+  bool can_coalesce(const BptPrefixLeafNode *rht) const;
+
+  void coalesce(BptPrefixLeafNode *rht);
+
+  // evens out the sizes in whichever direction needed.
+  void redistribute_left(BptPrefixLeafNode *lft);
+
+  void redistribute_right(BptPrefixLeafNode *rht);
+
+  KeyT key(int pos) const {
+    unsigned char bytes[KEY_SIZE];
+    full_key(pos, bytes);
+    return Codec::decode(bytes);
+  }
+  ValueT& value(int pos) { return values()[pos]; }
+  const ValueT& value(int pos) const { return values()[pos]; }
+  page_id_t rht_ptr() const { return rht_ptr_; }
+  void set_rht_ptr(page_id_t rht_ptr) { rht_ptr_ = rht_ptr; }
+  // takes over the key range up to hi, e.g. of dropped right siblings. Only an empty node
+  // is sure to fit: the prefix may get shorter.
+  void set_hi_fence(const KeyT &hi);
+
+private:
+  static int capacity_of(int prefix_len) {
+    return std::min<int>(CAPACITY_LIM, DATA_SIZE / (KEY_SIZE - prefix_len + sizeof(ValueT)));
+  }
+  static int common_prefix(const unsigned char *a, const unsigned char *b) {
+    int len = 0;
+    while(len < KEY_SIZE && a[len] == b[len]) ++len;
+    return len;
+  }
+
+  int suffix_len() const { return KEY_SIZE - prefix_len_; }
+  int fence_prefix_len() const { return (has_lo_ && has_hi_) ? common_prefix(lo_, hi_) : 0; }
+
+  ValueT* values() { return reinterpret_cast<ValueT*>(data_); }
+  const ValueT* values() const { return reinterpret_cast<const ValueT*>(data_); }
+  unsigned char* suffix(int pos) { return data_ + capacity_of(prefix_len_) * sizeof(ValueT) + pos * suffix_len(); }
+  const unsigned char* suffix(int pos) const {
+    return data_ + capacity_of(prefix_len_) * sizeof(ValueT) + pos * suffix_len();
+  }
+
+  void full_key(int pos, unsigned char *bytes) const {
+    memcpy(bytes, lo_, prefix_len_);
+    memcpy(bytes + prefix_len_, suffix(pos), suffix_len());
+  }
+  void assign(int pos, const unsigned char *bytes, const ValueT &value) {
+    memcpy(values() + pos, &value, sizeof(ValueT));
+    memcpy(suffix(pos), bytes + prefix_len_, suffix_len());
+  }
+  // re-encodes the stored suffixes after the fences changed.
+  // old_prefix holds the first old_prefix_len bytes of the old lower fence.
+  void relayout(const unsigned char *old_prefix, int old_prefix_len);
+
+  page_id_t rht_ptr_ {};
+  int16_t prefix_len_;
+  bool has_lo_, has_hi_;
+  unsigned char lo_[KEY_SIZE], hi_[KEY_SIZE];
+  alignas(DATA_ALIGN) unsigned char data_[DATA_SIZE];
+};
+
+template <class KeyT, size_t page_size = SECTOR_SIZE>
 class BptInternalNode : public BptNodeBase {
 
   struct Storage {
@@ -131,11 +343,13 @@ class BptInternalNode : public BptNodeBase {
     page_id_t child;
   };
 
-  static constexpr size_t CAPACITY = std::max(NODE_CAPACITY_LIM,
-    SectorAlignedSize(sizeof(Storage)) / sizeof(Storage));
+  static constexpr size_t CAPACITY = NodeCapacity(
+    AlignedSize(sizeof(BptNodeBase), alignof(Storage)), sizeof(Storage), page_size);
 
 public:
 
+  static constexpr size_t PAGE_SIZE = page_size;
+
   void init(int max_size = CAPACITY - 1);
 
   // returns size() if key too large.
@@ -160,6 +374,7 @@ public:
 
   const KeyT& key(int pos) const { return storage_[pos].key; }
   page_id_t child(int pos) const { return storage_[pos].child; }
+  void set_child(int pos, page_id_t child) { storage_[pos].child = child; }
 
 private:
   Storage storage_[CAPACITY];
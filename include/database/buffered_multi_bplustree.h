@@ -0,0 +1,146 @@
+#ifndef INSOMNIA_BUFFERED_MULTI_BPLUSTREE_H
+#define INSOMNIA_BUFFERED_MULTI_BPLUSTREE_H
+
+#include "multi_bplustree.h"
+#include "algorithm.h"
+
+namespace insomnia {
+
+// Write-optimized front of a MultiBplustree.
+// Insertions and removals are appended as messages to an in-memory buffer and applied to the
+// tree in key order once message_capacity of them pile up, so that a batch shares its leaf
+// writes instead of dirtying (and later writing back) one leaf per update.
+// Value reads (search, for_each_equal, scan) sort the new messages into the buffer and merge
+// it with the tree on the fly; the ones that hand out tree iterators flush the buffer first.
+// Insert and remove are blind and always succeed: a duplicate insertion or a removal of an
+// absent pair is dropped when the messages are applied.
+template <class KeyT, class ValueT, class KeyCompare = std::less<KeyT>, class ValueCompare = std::less<ValueT>,
+          class LeafT = BptLeafNode<KeyT, ValueT>>
+class BufferedMultiBplustree {
+
+  using Tree = MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>;
+
+  enum class MessageType : char {
+    Insert,
+    Remove,
+    Replace // remove the stored one, then insert this.
+  };
+
+  struct Message {
+    KeyT key;
+    ValueT value;
+    MessageType type;
+    size_t seq; // arrival order
+  };
+
+public:
+
+  // smaller buffers save few leaf writes: see WriteAmplificationBench.
+  static constexpr size_t DEFAULT_MESSAGE_CAPACITY = 4096;
+
+  using iterator = typename Tree::iterator;
+  using range_cursor = typename Tree::range_cursor;
+  using snapshot = typename Tree::snapshot;
+
+  BufferedMultiBplustree(const std::filesystem::path &path, int buffer_capacity, int replacer_k_arg,
+                         size_t message_capacity = DEFAULT_MESSAGE_CAPACITY);
+
+  ~BufferedMultiBplustree() { flush(); }
+
+  vector<ValueT> search(const KeyT &key);
+
+  bool insert(const KeyT &key, const ValueT &value);
+
+  bool remove(const KeyT &key, const ValueT &value);
+
+  // see MultiBplustree::remove_range. The pending messages are applied first.
+  void remove_range(const KeyT &lo, const KeyT &hi) { flush(); tree_.remove_range(lo, hi); }
+
+  // applies all pending messages to the tree.
+  void flush();
+
+  void clear() {
+    buffer_.clear();
+    sorted_cnt_ = 0;
+    tree_.clear();
+  }
+
+  void pin_internal_levels(int frame_budget) { tree_.pin_internal_levels(frame_budget); }
+
+  BptStats stats() { flush(); return tree_.stats(); }
+
+  // see MultiBplustree::compact_step.
+  bool compact_step(size_t budget) { flush(); return tree_.compact_step(budget); }
+
+  [[nodiscard]]
+  bool empty() {
+    flush();
+    return tree_.empty();
+  }
+
+  [[nodiscard]]
+  size_t pending() const { return buffer_.size(); }
+
+  // pages written back to disk so far.
+  size_t page_write_count() const { return tree_.page_write_count(); }
+
+  iterator begin() { flush(); return tree_.begin(); }
+  iterator end() { return tree_.end(); }
+  iterator find_upper(const KeyT &key) { flush(); return tree_.find_upper(key); }
+  iterator find(const KeyT &key, const ValueT &value) { flush(); return tree_.find(key, value); }
+  iterator find_nth(const KeyT &key, size_t rank) { flush(); return tree_.find_nth(key, rank); }
+  range_cursor equal_range(const KeyT &key) { flush(); return tree_.equal_range(key); }
+
+  // see MultiBplustree::for_each_equal. Pending messages are taken into account.
+  template <class Func>
+  void for_each_equal(const KeyT &key, Func &&fn);
+
+  // see MultiBplustree::scan. Values still in the buffer are visited (and modified) there.
+  template <class Pred, class Visit>
+  size_t scan(const KeyT &lo, const KeyT &hi, Pred &&pred, size_t limit, Visit &&visit);
+
+  template <class Pred>
+  vector<pair<KeyT, ValueT>> scan(const KeyT &lo, const KeyT &hi, Pred &&pred, size_t limit = SIZE_MAX);
+
+  // see MultiBplustree::take_snapshot. The pending messages are applied first.
+  snapshot take_snapshot() { flush(); return tree_.take_snapshot(); }
+
+private:
+
+  // sorts the messages that came after the last call into the sorted prefix,
+  // folding the ones about the same pair into one.
+  void settle();
+  // the first message with a key not lower than key. Requires a settled buffer.
+  size_t locate_key(const KeyT &key) const;
+  bool kv_less(const KeyT &k1, const ValueT &v1, const KeyT &k2, const ValueT &v2) const {
+    if(key_compare_(k1, k2))
+      return true;
+    if(key_compare_(k2, k1))
+      return false;
+    return value_compare_(v1, v2);
+  }
+
+  // walks the merged view of entries with lo <= key <= hi in order.
+  // fn(key, value, get_mut) returns false to stop; get_mut() gives the value for modification.
+  template <class Func>
+  void merged_walk(const KeyT &lo, const KeyT &hi, Func &&fn);
+
+  Tree tree_;
+  vector<Message> buffer_;
+  size_t sorted_cnt_ = 0; // buffer_[0, sorted_cnt_) is sorted by (key, value), one message per pair.
+  size_t seq_ = 0;
+  const size_t message_capacity_;
+  KeyCompare key_compare_;
+  ValueCompare value_compare_;
+};
+
+// buffered multi B+ tree with prefix-truncated leaves, see BptPrefixLeafNode.
+template <class KeyT, class ValueT, class KeyCompare = std::less<KeyT>, class ValueCompare = std::less<ValueT>>
+using PrefixBufferedMultiBplustree =
+  BufferedMultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, BptPrefixLeafNode<KeyT, ValueT>>;
+
+}
+
+#include "buffered_multi_bplustree.tcc"
+
+#endif
@@ -0,0 +1,207 @@
+#ifndef INSOMNIA_EXTENDIBLE_HASH_H
+#define INSOMNIA_EXTENDIBLE_HASH_H
+
+#include "optional.h"
+#include "bloom_filter.h"
+#include "buffer_pool.h"
+#include "bplustree_nodes.h"
+
+namespace insomnia {
+
+// On-disk extendible hash table for exact-match maps.
+// The directory (2^global_depth bucket page ids) is held in memory and written to its own
+// file on destruction, so a lookup visits exactly one bucket page.
+// Buckets that run empty are merged back into their buddies.
+template <class KeyT, class ValueT, class Hash = std::hash<KeyT>, class KeyEqual = std::equal_to<KeyT>>
+class ExtendibleHashTable {
+
+  class Bucket {
+    struct Storage {
+      KeyT key;
+      ValueT value;
+    };
+    static constexpr size_t CAPACITY = std::max(NODE_CAPACITY_LIM,
+      (SectorAlignedSize(sizeof(Storage) + 2 * sizeof(int)) - 2 * sizeof(int)) / sizeof(Storage));
+
+  public:
+    void init(int local_depth) {
+      local_depth_ = local_depth;
+      size_ = 0;
+    }
+    bool full() const { return size_ == CAPACITY; }
+    // returns size() if absent.
+    int locate(const KeyT &key, const KeyEqual &key_equal) const {
+      int pos = 0;
+      while(pos < size_ && !key_equal(storage_[pos].key, key)) ++pos;
+      return pos;
+    }
+    void insert(const KeyT &key, const ValueT &value) {
+      storage_[size_] = {key, value};
+      ++size_;
+    }
+    // the last entry takes its place.
+    void remove(int pos) {
+      --size_;
+      if(pos != size_)
+        memcpy(storage_ + pos, storage_ + size_, sizeof(Storage));
+    }
+
+    int local_depth() const { return local_depth_; }
+    void set_local_depth(int local_depth) { local_depth_ = local_depth; }
+    int size() const { return size_; }
+    const KeyT& key(int pos) const { return storage_[pos].key; }
+    ValueT& value(int pos) { return storage_[pos].value; }
+    const ValueT& value(int pos) const { return storage_[pos].value; }
+
+  private:
+    int local_depth_;
+    int size_;
+    Storage storage_[CAPACITY];
+  };
+
+  struct DirPage {
+    static constexpr size_t SLOT_CNT = SECTOR_SIZE / sizeof(page_id_t);
+    page_id_t slots[SLOT_CNT];
+  };
+
+  struct Meta {
+    int global_depth;
+    int dir_page_cnt;
+    size_t slot_cnt;
+    size_t size;
+  };
+
+  // more would mean the hash hardly spreads the keys.
+  static constexpr int GLOBAL_DEPTH_LIM = 30;
+
+  using BufferType = BufferPool<Bucket, Meta>;
+  using Visitor = typename BufferType::Visitor;
+  using DirBufferType = BufferPool<DirPage>;
+
+public:
+
+  // filter_bits_per_key > 0 keeps a Bloom filter of the key hashes, so that find, search and
+  // remove of an absent key mostly skip the bucket read. It takes the inserted keys, is rebuilt
+  // when it outgrows its size and is saved on destruction.
+  ExtendibleHashTable(const std::filesystem::path &path, int buffer_capacity, int replacer_k_arg,
+                      size_t filter_bits_per_key = 0);
+
+  ~ExtendibleHashTable();
+
+  optional<ValueT> search(const KeyT &key);
+
+  bool insert(const KeyT &key, const ValueT &value);
+
+  bool remove(const KeyT &key);
+
+  void clear() {
+    buf_pool_.clear();
+    dir_pool_.clear();
+    dir_.clear();
+    global_depth_ = 0;
+    dir_page_cnt_ = 0;
+    size_ = 0;
+    filter_.reset(0);
+  }
+
+  [[nodiscard]]
+  bool empty() const { return size_ == 0; }
+
+  [[nodiscard]]
+  size_t size() const { return size_; }
+
+  // the directory has 2^global_depth() slots.
+  int global_depth() const { return global_depth_; }
+
+  class iterator {
+    friend ExtendibleHashTable;
+
+  public:
+    iterator() = default;
+
+    bool is_valid() const { return visitor_.is_valid(); }
+    void reset() {
+      table_ = nullptr;
+      visitor_.drop();
+      slot_ = pos_ = 0;
+    }
+
+    pair<const KeyT&, ValueT&> operator*() {
+      if(!visitor_.is_valid()) throw invalid_iterator("invalid hash table iterator");
+      auto ptr = visitor_.template as_mut<Bucket>();
+      return pair<const KeyT&, ValueT&>(ptr->key(pos_), ptr->value(pos_));
+    }
+    pair<const KeyT&, const ValueT&> operator*() const { return view(); }
+    pair<const KeyT&, const ValueT&> view() const {
+      if(!visitor_.is_valid()) throw invalid_iterator("invalid hash table iterator");
+      auto ptr = visitor_.template as<Bucket>();
+      return pair<const KeyT&, const ValueT&>(ptr->key(pos_), ptr->value(pos_));
+    }
+
+    // buckets are visited in directory order, each once.
+    iterator& operator++();
+
+    bool operator==(const iterator &other) const {
+      if(table_ != other.table_) return false;
+      if(table_ == nullptr) return true;
+      if(visitor_.is_valid() != other.visitor_.is_valid()) return false;
+      if(!visitor_.is_valid()) return true;
+      return (visitor_.page_id() == other.visitor_.page_id()) && (pos_ == other.pos_);
+    }
+    bool operator!=(const iterator &other) const {
+      return !(*this == other);
+    }
+
+  private:
+    iterator(ExtendibleHashTable *table, Visitor visitor, size_t slot, int pos)
+      : table_(table), visitor_(std::move(visitor)), slot_(slot), pos_(pos) {}
+
+    // moves to the first entry at or after (slot_, pos_).
+    void settle();
+
+    ExtendibleHashTable *table_ {nullptr};
+    Visitor visitor_;
+    size_t slot_ {0};
+    int pos_ {0};
+  };
+
+  iterator begin();
+  iterator end() { return iterator(this, Visitor(), 0, 0); }
+
+  // return end() if failed.
+  iterator find(const KeyT &key);
+
+private:
+
+  size_t slot_of(const KeyT &key) const { return hash_(key) & ((size_t(1) << global_depth_) - 1); }
+
+  // true if the filter tells that key is not in the table.
+  bool surely_absent(const KeyT &key) const {
+    return filter_bits_ > 0 && !filter_.may_contain(hash_(key));
+  }
+  // refills the filter from the buckets, sized for twice the keys there.
+  void rebuild_filter();
+
+  // splits the bucket of the given slot, doubling the directory if needed.
+  void split(size_t slot);
+  // merges the (empty) bucket of the given slot into its buddy while possible.
+  void merge(size_t slot);
+
+  BufferType buf_pool_;
+  DirBufferType dir_pool_;
+  vector<page_id_t> dir_;
+  int global_depth_;
+  int dir_page_cnt_;
+  size_t size_;
+  [[no_unique_address]] Hash hash_;
+  [[no_unique_address]] KeyEqual key_equal_;
+  const size_t filter_bits_; // 0 if the filter is off
+  const std::filesystem::path filter_path_;
+  BloomFilter filter_;
+};
+
+}
+
+#include "extendible_hash.tcc"
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef INSOMNIA_KEY_CODEC_H
+#define INSOMNIA_KEY_CODEC_H
+
+#include <concepts>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+#include "pair.h"
+
+namespace insomnia {
+
+// Encodes a key into fixed-length bytes whose memcmp order is the order of the key
+// (big-endian, sign bit flipped for signed integers, members concatenated for pairs).
+// Needed by nodes that cut off the common prefix of their keys.
+template <class T>
+struct KeyCodec {};
+
+template <class Integer> requires std::is_integral_v<Integer>
+struct KeyCodec<Integer> {
+  static constexpr size_t SIZE = sizeof(Integer);
+
+  static void encode(const Integer &val, unsigned char *out) {
+    using Unsigned = std::make_unsigned_t<Integer>;
+    auto bits = static_cast<Unsigned>(val);
+    if constexpr (std::is_signed_v<Integer>)
+      bits ^= static_cast<Unsigned>(Unsigned(1) << (SIZE * 8 - 1));
+    for(size_t i = 0; i < SIZE; ++i)
+      out[i] = static_cast<unsigned char>(bits >> (8 * (SIZE - 1 - i)));
+  }
+
+  static Integer decode(const unsigned char *in) {
+    using Unsigned = std::make_unsigned_t<Integer>;
+    Unsigned bits = 0;
+    for(size_t i = 0; i < SIZE; ++i)
+      bits = static_cast<Unsigned>((bits << 8) | in[i]);
+    if constexpr (std::is_signed_v<Integer>)
+      bits ^= static_cast<Unsigned>(Unsigned(1) << (SIZE * 8 - 1));
+    return static_cast<Integer>(bits);
+  }
+};
+
+template <class T1, class T2>
+struct KeyCodec<pair<T1, T2>> {
+  static constexpr size_t SIZE = KeyCodec<T1>::SIZE + KeyCodec<T2>::SIZE;
+
+  static void encode(const pair<T1, T2> &val, unsigned char *out) {
+    KeyCodec<T1>::encode(val.first, out);
+    KeyCodec<T2>::encode(val.second, out + KeyCodec<T1>::SIZE);
+  }
+
+  static pair<T1, T2> decode(const unsigned char *in) {
+    return pair<T1, T2>(KeyCodec<T1>::decode(in), KeyCodec<T2>::decode(in + KeyCodec<T1>::SIZE));
+  }
+};
+
+template <class T>
+concept KeyEncodable = requires(const T &val, unsigned char *buf) {
+  { KeyCodec<T>::SIZE } -> std::convertible_to<size_t>;
+  KeyCodec<T>::encode(val, buf);
+  { KeyCodec<T>::decode(buf) } -> std::same_as<T>;
+};
+
+}
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef INSOMNIA_OVERFLOW_BPLUSTREE_H
+#define INSOMNIA_OVERFLOW_BPLUSTREE_H
+
+#include "optional.h"
+#include "bplustree.h"
+
+namespace insomnia {
+
+// A Bplustree whose values live out of line.
+// Leaves only keep [key, heap page id], so the fanout is decided by the key size,
+// and the (large) value is read from the heap file only when it's dereferenced.
+template <class KeyT, class ValueT, class KeyCompare = std::less<KeyT>>
+class OverflowBplustree {
+
+  using IndexTree = Bplustree<KeyT, page_id_t, KeyCompare>;
+  using HeapType = BufferPool<ValueT>;
+  using HeapVisitor = typename HeapType::Visitor;
+
+public:
+
+  OverflowBplustree(const std::filesystem::path &path, int buffer_capacity, int replacer_k_arg);
+  // filter_bits_per_key > 0 puts a Bloom filter on the index, see Bplustree.
+  OverflowBplustree(const std::filesystem::path &path, int buffer_capacity, int replacer_k_arg,
+                    size_t filter_bits_per_key)
+    requires std::is_constructible_v<IndexTree, const std::filesystem::path&, int, int, size_t>;
+
+  ~OverflowBplustree() = default;
+
+  optional<ValueT> search(const KeyT &key);
+
+  bool insert(const KeyT &key, const ValueT &value);
+
+  bool remove(const KeyT &key);
+
+  void clear() {
+    index_.clear();
+    heap_.clear();
+  }
+
+  void pin_internal_levels(int frame_budget) { index_.pin_internal_levels(frame_budget); }
+
+  // of the index tree; the heap pages are not included.
+  BptStats stats() { return index_.stats(); }
+
+  // see Bplustree::compact_step. Only the index tree is compacted.
+  bool compact_step(size_t budget) { return index_.compact_step(budget); }
+
+  [[nodiscard]]
+  bool empty() const { return index_.empty(); }
+
+  // pages of the heap file: the highest one allocated so far, and the freed ones up for reuse.
+  page_id_t heap_max_page_id() { return heap_.max_page_id(); }
+  size_t heap_free_page_count() const { return heap_.free_page_count(); }
+
+  class iterator {
+    friend OverflowBplustree;
+
+  public:
+    iterator() = default;
+
+    bool is_valid() const { return index_it_.is_valid(); }
+    void reset() {
+      heap_ = nullptr;
+      value_visitor_.drop();
+      index_it_.reset();
+    }
+
+    pair<const KeyT&, ValueT&> operator*() {
+      load();
+      return insomnia::make_pair(std::ref(index_it_.view().first),
+                                 std::ref(*value_visitor_.template as_mut<ValueT>()));
+    }
+    pair<const KeyT&, const ValueT&> operator*() const { return view(); }
+    pair<const KeyT&, const ValueT&> view() const {
+      load();
+      return insomnia::make_pair(std::ref(index_it_.view().first),
+                                 std::ref(*value_visitor_.template as<ValueT>()));
+    }
+
+    // the page id of the value in the heap file.
+    page_id_t value_page_id() const { return index_it_.view().second; }
+
+    iterator& operator++() {
+      value_visitor_.drop();
+      ++index_it_;
+      return *this;
+    }
+
+    bool operator==(const iterator &other) const { return index_it_ == other.index_it_; }
+    bool operator!=(const iterator &other) const { return !(*this == other); }
+
+  private:
+    iterator(HeapType *heap, typename IndexTree::iterator index_it)
+      : heap_(heap), index_it_(std::move(index_it)) {}
+
+    // the value page is only visited when it's needed.
+    void load() const {
+      if(!index_it_.is_valid()) throw invalid_iterator("invalid overflow-bpt iterator");
+      if(!value_visitor_.is_valid())
+        value_visitor_ = heap_->visitor(index_it_.view().second);
+    }
+
+    HeapType *heap_ {nullptr};
+    typename IndexTree::iterator index_it_;
+    mutable HeapVisitor value_visitor_;
+  };
+
+  iterator begin() { return iterator(&heap_, index_.begin()); }
+  iterator end() { return iterator(&heap_, index_.end()); }
+
+  // return end() if failed.
+  iterator find(const KeyT &key) { return iterator(&heap_, index_.find(key)); }
+  // the first that holds a key not lower than given key.
+  iterator find_upper(const KeyT &key) { return iterator(&heap_, index_.find_upper(key)); }
+
+private:
+
+  IndexTree index_;
+  HeapType heap_;
+};
+
+}
+
+#include "overflow_bplustree.tcc"
+
+#endif
@@ -13,27 +13,33 @@ inline constexpr size_t SECTOR_SIZE = 4096; // 512 in some regions/nations... ma
 
 struct MonoType {};
 
-constexpr size_t SectorAlignedSize(size_t initial_size) {
-  return (initial_size + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
+// rounded up to a multiple of page_size, which is SECTOR_SIZE itself or a multiple of it.
+constexpr size_t SectorAlignedSize(size_t initial_size, size_t page_size = SECTOR_SIZE) {
+  return (initial_size + page_size - 1) / page_size * page_size;
 }
 
+// pages are made of whole sectors: 4K, 16K, 64K...
+template <size_t page_size>
+concept ValidPageSize = (page_size >= SECTOR_SIZE) && (page_size % SECTOR_SIZE == 0);
+
 template <class T>
 concept SectorAligned =
     !std::is_same_v<T, MonoType> &&
     (sizeof(T) % SECTOR_SIZE == 0);
 
-template <class T, size_t max_size = sizeof(T)>
-requires (max_size >= sizeof(T))
+// a page holding an object of at most max_size bytes, spanning as many page_size units as needed.
+template <class T, size_t max_size = sizeof(T), size_t page_size = SECTOR_SIZE>
+requires (max_size >= sizeof(T) && ValidPageSize<page_size>)
 class SectorWrapper {
 public:
   static constexpr size_t size() { return sizeof(data_); }
   char* data() { return data_; }
 private:
-  alignas(SECTOR_SIZE) char data_[SectorAlignedSize(max_size)] {};
+  alignas(SECTOR_SIZE) char data_[SectorAlignedSize(max_size, page_size)] {};
 };
 
-template <size_t max_size>
-class SectorWrapper<MonoType, max_size> {
+template <size_t max_size, size_t page_size>
+class SectorWrapper<MonoType, max_size, page_size> {
   static constexpr size_t size() { return 0; }
   char* data() = delete;
 };
@@ -41,8 +47,8 @@ class SectorWrapper<MonoType, max_size> {
 template <class T>
 struct is_mono_sector_wrapper : std::false_type {};
 
-template <size_t max_size>
-struct is_mono_sector_wrapper<SectorWrapper<MonoType, max_size>> : std::true_type {};
+template <size_t max_size, size_t page_size>
+struct is_mono_sector_wrapper<SectorWrapper<MonoType, max_size, page_size>> : std::true_type {};
 
 template <class T>
 inline constexpr bool is_void_sector_wrapper_v = is_mono_sector_wrapper<T>::value;
@@ -52,18 +58,22 @@ concept EmptyMeta =
     std::is_same_v<Meta, MonoType> ||
     is_void_sector_wrapper_v<Meta>;
 
-template <class T, class Meta>
+template <class T, class Meta, size_t page_size>
 concept FstreamConcept =
-  SectorAligned<T> &&
+  SectorAligned<T> && ValidPageSize<page_size> && (sizeof(T) % page_size == 0) &&
   (EmptyMeta<Meta> || SectorAligned<Meta>);
 
 // Hard coded under the fact that NULL_INDEX = 0.
-template <class T, class Meta = MonoType>
-requires FstreamConcept<T, Meta>
+// Each T takes whole pages of page_size bytes; the meta region is padded to a page,
+// so that every T starts on a page boundary of the file.
+template <class T, class Meta = MonoType, size_t page_size = SECTOR_SIZE>
+requires FstreamConcept<T, Meta, page_size>
 class fstream {
   static constexpr size_t SIZE_T = sizeof(T);
-  static constexpr size_t SIZE_META = EmptyMeta<Meta> ? 0 : sizeof(Meta);
+  static constexpr size_t SIZE_META = EmptyMeta<Meta> ? 0 : SectorAlignedSize(sizeof(Meta), page_size);
 public:
+  static constexpr size_t PAGE_SIZE = page_size;
+
   explicit fstream(const std::filesystem::path &path);
   ~fstream();
   void write(page_id_t pos, const T *data);
@@ -72,14 +82,21 @@ public:
   bool read_meta(Meta *data) requires (!EmptyMeta<Meta>); // returns false if read failed.
   page_id_t alloc() { return index_allocator_.alloc(); }
   page_id_t max_page_id() const { return index_allocator_.max_index(); }
+  size_t free_page_count() const { return index_allocator_.free_count(); }
   void dealloc(page_id_t page_id) { index_allocator_.dealloc(page_id); }
+  bool acquire(page_id_t page_id) { return index_allocator_.acquire(page_id); }
+  // drops the pages after max_page_id from the allocator and the file.
+  void truncate(page_id_t max_page_id);
   void clear();
+  // pages written since opened.
+  size_t write_count() const { return write_cnt_; }
 private:
   void reserve(size_t required_size);
   IndexPool index_allocator_;
   std::fstream fstream_;
   const std::filesystem::path path_;
   size_t file_size_;
+  size_t write_cnt_ = 0;
 };
 
 }
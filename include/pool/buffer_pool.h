@@ -7,10 +7,17 @@
 namespace insomnia {
 
 using frame_id_t = LruKReplacer::access_id_t;
+using epoch_t = size_t;
 
 // According to the document of LruKReplacer,
 // replacer_k_arg is recommended to be power of 2.
-template <class T, class Meta = MonoType, size_t max_size = sizeof(T)> requires (max_size >= sizeof(T))
+// Pages are page_size bytes (a multiple of SECTOR_SIZE); a T larger than that spans several.
+// Read snapshots: open_snapshot() hands out an epoch. While any snapshot is open, the first
+// write to a page in an epoch (as_mut, or dealloc) keeps a before-image of it; snapshot_as()
+// reads a page as it was at the epoch, from the oldest image taken after it or from the page
+// itself. Closing a snapshot frees the images no open epoch reads any more.
+template <class T, class Meta = MonoType, size_t max_size = sizeof(T), size_t page_size = SECTOR_SIZE>
+  requires (max_size >= sizeof(T) && ValidPageSize<page_size>)
 class BufferPool {
 public:
   class Visitor;
@@ -19,13 +26,13 @@ public:
   ~BufferPool() { flush_all(); }
 
 private:
-  using fstream_t = fstream<SectorWrapper<T, max_size>, SectorWrapper<Meta>>;
+  using fstream_t = fstream<SectorWrapper<T, max_size, page_size>, SectorWrapper<Meta>, page_size>;
   class Frame {
     friend Visitor;
     friend BufferPool;
   public:
     explicit Frame(frame_id_t _frame_id)
-      : frame_id(_frame_id), pin_count(0), is_dirty(false), is_valid(false) {}
+      : frame_id(_frame_id), pin_count(0), is_dirty(false), is_valid(false), image_epoch(0) {}
   private:
     char* data() { return data_wrapper.data(); }
 
@@ -34,7 +41,13 @@ private:
     size_t pin_count; // only to avoid halfway drop.
     bool is_dirty;
     bool is_valid;
-    SectorWrapper<T, max_size> data_wrapper;
+    epoch_t image_epoch; // a before-image of the page is kept for this epoch. 0 if unknown.
+    SectorWrapper<T, max_size, page_size> data_wrapper;
+  };
+
+  struct BeforeImage {
+    epoch_t epoch; // taken on the first write in this epoch
+    vector<char> data;
   };
 
 public:
@@ -42,7 +55,7 @@ public:
     // validness checked by frame_ == nullptr.
     friend BufferPool;
   public:
-    Visitor() : frame_(nullptr), fs_(nullptr), replacer_(nullptr) {}
+    Visitor() : frame_(nullptr), fs_(nullptr), replacer_(nullptr), pool_(nullptr) {}
     // Actually no need in single thread... whatever.
     Visitor(const Visitor &) = delete;
     Visitor& operator=(const Visitor &) noexcept = delete;
@@ -52,6 +65,9 @@ public:
     void flush();
     void drop();
 
+    // another pin on the same frame. Skips the page table and the replacer.
+    Visitor share() const;
+
     bool is_valid() const { return frame_ != nullptr; }
     page_id_t page_id() const { return frame_->page_id; }
     char* data() { return frame_->data(); }
@@ -63,11 +79,12 @@ public:
     Derived* as_mut();
 
   private:
-    Visitor(Frame *frame, fstream_t *fs, LruKReplacer *replacer);
+    Visitor(Frame *frame, fstream_t *fs, LruKReplacer *replacer, BufferPool *pool);
 
     Frame *frame_;
     fstream_t *fs_;
     LruKReplacer *replacer_;
+    BufferPool *pool_;
   };
 
   void write_meta(const Meta *meta) requires (!EmptyMeta<Meta>);
@@ -75,7 +92,12 @@ public:
 
   page_id_t alloc() { return fs_.alloc(); }
   void dealloc(page_id_t page_id);
+  // takes the given page if it is free. Returns false if in use.
+  bool acquire(page_id_t page_id) { return fs_.acquire(page_id); }
+  // gives the pages after max_page_id back to the file system. None of them may be in use.
+  void truncate(page_id_t max_page_id);
   page_id_t max_page_id() { return fs_.max_page_id(); }
+  size_t free_page_count() const { return fs_.free_page_count(); }
 
   Visitor visitor(page_id_t page_id);
 
@@ -84,8 +106,25 @@ public:
 
   void clear();
 
+  // pages written back to disk so far, including those of Visitor::flush.
+  size_t page_write_count() const { return fs_.write_count(); }
+
+  // opens a read view of all pages as they are now. Visitors taking as_mut pointers must not
+  // be held across the call.
+  epoch_t open_snapshot();
+  void close_snapshot(epoch_t epoch);
+  size_t snapshot_count() const { return snapshots_.size(); }
+  // the page as of the snapshot epoch. The live page is pinned through holder if it is the one;
+  // a before-image lives until the snapshot is closed.
+  template <class Derived> requires (std::derived_from<Derived, T> && (max_size >= sizeof(Derived)))
+  const Derived* snapshot_as(page_id_t page_id, epoch_t epoch, Visitor &holder);
+  // before-images kept for the open snapshots.
+  size_t before_image_count() const { return image_cnt_; }
+
 private:
   void flush_frame(Frame &frame);
+  // keeps the content of the frame for the open snapshots, unless done in this epoch.
+  void keep_before_image(Frame &frame);
 
   const std::filesystem::path path_;
   const int frame_count_;
@@ -95,6 +134,10 @@ private:
   fstream_t fs_;
   LruKReplacer replacer_;
   [[no_unique_address]] SectorWrapper<Meta> meta_wrapper_;
+  epoch_t epoch_ = 1; // writes happen in this epoch; a snapshot opened now sees them all.
+  vector<epoch_t> snapshots_; // open snapshot epochs, ascending
+  unordered_map<page_id_t, vector<BeforeImage>> images_; // per page, by ascending epoch
+  size_t image_cnt_ = 0;
 };
 
 // no disk space recycle implemented.
@@ -150,6 +193,13 @@ public:
       buffer_pool_.alloc();
     return ++max_index_;
   }
+  // n consecutive indices, the first returned. Their content is zeros until written.
+  index_t alloc(size_t n) {
+    index_t first = max_index_ + 1;
+    for(size_t i = 0; i < n; ++i)
+      alloc();
+    return first;
+  }
   Visitor visitor(index_t index) {
     if(index == NULL_INDEX) throw pool_exception("Using invalid index");
     return Visitor(buffer_pool_.visitor((index - 1) / CAPACITY + 1), (index - 1) % CAPACITY);
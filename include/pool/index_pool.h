@@ -16,7 +16,13 @@ public:
   ~IndexPool();
   index_t alloc();
   void dealloc(index_t index); // no solid validness check here.
+  // takes the given index if it is free (or not handed out yet). Returns false if in use.
+  bool acquire(index_t index);
+  // forgets every index above max_index. The caller guarantees none of them is in use.
+  void truncate(index_t max_index);
   index_t max_index() const { return max_index_; }
+  // indices given back and not yet reused.
+  size_t free_count() const { return unallocated_.size(); }
   void clear();
 private:
   void load();
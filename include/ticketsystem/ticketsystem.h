@@ -22,6 +22,12 @@ public:
     msgr_.flush(); // Huh.
   }
 
+  // shape of the on-disk indices, for deciding on rebuilds.
+  void report_index_stats(std::ostream &os) {
+    train_mgr_.report_index_stats(os);
+    order_mgr_.report_index_stats(os);
+  }
+
 private:
 
   static constexpr ism::hash_result_t hash(const char *str) {
@@ -39,8 +45,13 @@ private:
 
   using CommandFunc = void (TicketSystem::*)();
 
+  // the indices are compacted a few leaves at a time between commands.
+  static constexpr size_t COMPACT_PERIOD = 256;
+  static constexpr size_t COMPACT_BUDGET = 8;
+
   ism::unordered_map<ism::hash_result_t, CommandFunc> command_hashmap_;
   timestamp_t timestamp_ {};
+  size_t command_cnt_ = 0;
   char input_[16384] {};
   const char *token_ = input_;
   SystemStatus system_status_ = SystemStatus::StatGood;
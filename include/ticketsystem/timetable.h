@@ -0,0 +1,103 @@
+#ifndef TICKETSYSTEM_TIMETABLE_H
+#define TICKETSYSTEM_TIMETABLE_H
+
+#include "vector.h"
+#include "unordered_map.h"
+#include "ts_types.h"
+
+namespace ticket_system {
+
+class Timetable;
+
+// A released train as read from the Timetable: what the query paths need of a TrainType,
+// without the station names. Valid until the next Timetable::add or clear.
+class TrainRoute {
+  friend Timetable;
+
+public:
+  TrainRoute() = default;
+
+  bool is_valid() const { return train_ != nullptr; }
+
+  train_hid_t hash() const { return train_->train_hid; }
+  const train_id_t& train_id() const { return train_->train_id; }
+  stn_num_t stn_num() const { return train_->stn_num; }
+  seat_num_t max_seat_num() const { return train_->max_seat_num; }
+  time_hm_t start_time() const { return train_->start_time; }
+  date_md_t start_date() const { return train_->start_date; }
+  date_md_t final_date() const { return train_->final_date; }
+  ism::index_t seat_base() const { return train_->seat_base; }
+
+  hash_stn_name_t stn_hid(stn_num_t stn_ord) const { return stn_hids_[stn_ord]; }
+  // see TrainType for the meaning of the time lists.
+  time_dur_t departure_time(stn_num_t stn_ord) const { return departure_times_[stn_ord]; }
+  time_dur_t arrival_time(stn_num_t stn_ord) const { return arrival_times_[stn_ord]; }
+
+  price_t cost(stn_num_t from_ord, stn_num_t dest_ord) const {
+    return prices_[dest_ord] - prices_[from_ord];
+  }
+  time_dur_t time(stn_num_t from_ord, stn_num_t dest_ord) const {
+    return arrival_times_[dest_ord] - departure_times_[from_ord];
+  }
+
+  // see TrainType::check_train_departure_date.
+  bool check_train_departure_date(const date_md_t &train_departure_date) const {
+    return train_->start_date <= train_departure_date && train_departure_date <= train_->final_date;
+  }
+  // see TrainType::get_train_departure_date.
+  date_md_t get_train_departure_date(const date_md_t &passenger_departure_date, stn_num_t stn_ord) const {
+    date_time_t date_time_here(passenger_departure_date, train_->start_time + departure_times_[stn_ord]);
+    date_time_here -= departure_times_[stn_ord];
+    return date_time_here.date_md();
+  }
+
+private:
+  struct Train {
+    train_hid_t  train_hid;
+    train_id_t   train_id;
+    stn_num_t    stn_num;
+    seat_num_t   max_seat_num;
+    time_hm_t    start_time;
+    date_md_t    start_date;
+    date_md_t    final_date;
+    ism::index_t seat_base;
+    size_t       route_beg; // where its stations start in the route arrays
+  };
+
+  const Train *train_ = nullptr;
+  const hash_stn_name_t *stn_hids_ = nullptr;
+  const time_dur_t *departure_times_ = nullptr;
+  const time_dur_t *arrival_times_ = nullptr;
+  const price_t *prices_ = nullptr;
+};
+
+// The routes of the released trains, held in memory for the query paths so that they don't
+// read whole TrainType records from the train index.
+// Routes are packed one after another into shared arrays by field (station hashes, time
+// offsets, prefix prices), so that walking a route stays within a few cache lines.
+// Filled from the train index on startup and by ReleaseTrain; released trains never change.
+class Timetable {
+public:
+  Timetable() = default;
+
+  void add(const TrainType &train);
+  // invalid if the train is not released.
+  TrainRoute find(train_hid_t train_hid);
+
+  size_t size() const { return trains_.size(); }
+  void clear();
+
+private:
+  using Train = TrainRoute::Train;
+
+  ism::vector<Train> trains_;
+  ism::unordered_map<train_hid_t, size_t> slot_map_; // index in trains_
+  ism::vector<hash_stn_name_t> stn_hids_;
+  ism::vector<time_dur_t> departure_times_;
+  ism::vector<time_dur_t> arrival_times_;
+  ism::vector<price_t> prices_;
+};
+
+}
+
+#endif
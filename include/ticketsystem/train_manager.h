@@ -2,13 +2,25 @@
 #define TICKETSYSTEM_TRAIN_MANAGER_H
 
 #include "bplustree.h"
+#include "overflow_bplustree.h"
+#include "buffered_multi_bplustree.h"
 #include "ts_types.h"
+#include "timetable.h"
+#include "work_stealing_pool.h"
 #include "messenger.h"
 
 namespace ticket_system {
 
 class TrainManager {
 public:
+  // how QueryTransfer pairs the trains leaving the departure station with those reaching
+  // the destination. Both give the same answers.
+  // MergeJoin sorts the (train, interval station) candidates of both sides and tries every
+  // pair sharing a station. HashJoin groups both sides by interval station, orders each group
+  // by its part of the cost or time, and stops walking a group once no plan in it can beat
+  // the best one found. Its groups are searched in parallel on transfer_pool_.
+  enum class TransferEngine { MergeJoin, HashJoin };
+
   TrainManager(std::filesystem::path path, ism::Messenger &msgr);
   ~TrainManager() = default;
 
@@ -31,18 +43,91 @@ public:
     const username_t &username,
     const train_id_t &train_id, stn_name_t from_stn, stn_name_t dest_stn,
     date_md_t passenger_departure_date, seat_num_t ticket_num, bool accept_waitlist);
-  ism::Bplustree<ism::pair<days_count_t, train_hid_t>, TrainSeatStatus>::iterator
-  get_seat_status_iter(const train_id_t &train_id, date_md_t train_dep_date);
+  // the seat status of a released train running on the given date, initialized if unsold.
+  ism::CompressedBufferPool<TrainSeatStatus>::Visitor
+  get_seat_status_visitor(const train_id_t &train_id, date_md_t train_dep_date);
   void clean();
+  void report_index_stats(std::ostream &os);
+  // one compaction step of budget leaves on each index.
+  void compact_step(size_t budget);
+  void set_transfer_engine(TransferEngine engine) { transfer_engine_ = engine; }
 
 private:
 
-  ism::Bplustree<train_hid_t, TrainType> train_hid_train_map_;
-  ism::Bplustree<ism::pair<days_count_t, train_hid_t>, TrainSeatStatus> train_hid_seats_map_;
+  // a journey of QueryTransfer: S from stn SS to ST, then T from stn TS (the same station) to TT.
+  struct TransferPlan {
+    TrainRoute from_train, dest_train;
+    date_time_t date_time_SS, date_time_ST, date_time_TS, date_time_TT;
+    date_md_t from_train_dep_date, dest_train_dep_date;
+    stn_num_t stn_ord_SS, stn_ord_ST, stn_ord_TS, stn_ord_TT;
+    hash_stn_name_t interval_stn_hid;
+    price_t cost;
+    time_dur_t time;
+  };
+
+  // fills plan, T taken on its first run leaving TS after S arrives there.
+  // Returns false if T has no such run.
+  static bool plan_transfer(
+    const TrainRoute &from_train, stn_num_t stn_ord_SS, stn_num_t stn_ord_ST, date_md_t from_train_dep_date,
+    const TrainRoute &dest_train, stn_num_t stn_ord_TS, stn_num_t stn_ord_TT, TransferPlan &plan);
+  // the order of the answers: cost or time first, then the other one, the train ids and
+  // the interval station hash.
+  static bool transfer_less(const TransferPlan &A, const TransferPlan &B, bool is_cost_order);
+  // the best plan into best, see TransferEngine. Returns false if there is none.
+  bool transfer_merge_join(
+    hash_stn_name_t from_hsid, hash_stn_name_t dest_hsid,
+    date_md_t passenger_departure_date, bool is_cost_order, TransferPlan &best);
+  bool transfer_hash_join(
+    hash_stn_name_t from_hsid, hash_stn_name_t dest_hsid,
+    date_md_t passenger_departure_date, bool is_cost_order, TransferPlan &best);
+
+  // TrainInfo is TrainType, TrainRoute or StnPairTrainInfo.
+  template <class TrainInfo>
+  ism::CompressedBufferPool<TrainSeatStatus>::Visitor
+  seat_status_visitor(const TrainInfo &train, date_md_t train_dep_date) {
+    return seat_calendar_.visitor(train.seat_base() + (train_dep_date.count() - train.start_date().count()));
+  }
+  // an unsold run has all seats free.
+  template <class TrainInfo>
+  seat_num_t available_seat_num(const TrainInfo &train, date_md_t train_dep_date, stn_num_t from_ord, stn_num_t dest_ord) {
+    auto visitor = seat_status_visitor(train, train_dep_date);
+    if(visitor.as()->is_unsold())
+      return train.max_seat_num();
+    return visitor.as()->available_seat_num(from_ord, dest_ord);
+  }
+  static StnPairTrainInfo stn_pair_info(const TrainRoute &route, stn_num_t from_ord, stn_num_t dest_ord);
+  // lists a released train under all its station pairs.
+  void index_stn_pairs(const TrainType &train);
+
+  template <class ValueCompare>
+  using StnPairIndex = ism::PrefixBufferedMultiBplustree<
+    ism::pair<hash_stn_name_t, hash_stn_name_t>, StnPairTrainInfo,
+    std::less<ism::pair<hash_stn_name_t, hash_stn_name_t>>, ValueCompare>;
+
+  // TrainType is several KiB, so it's kept out of the leaves.
+  ism::OverflowBplustree<train_hid_t, TrainType> train_hid_train_map_;
+  // the seat statuses of released trains, one per running day. A train takes a run of
+  // consecutive indices on release, so a lookup is an index computation and one page access.
+  // A record is only written on the first sale of its day, see TrainSeatStatus::is_unsold.
+  ism::CompressedBufferPool<TrainSeatStatus> seat_calendar_;
   // stores trains that pass this station in the form of [htid, #the ordinal of the station of the train]
   // only to be enlarged in ReleaseTrain.
   // So via this method, only released trains can be seen.
   ism::MultiBplustree<hash_stn_name_t, ism::pair<train_hid_t, stn_num_t>> stn_hid_train_info_multimap_;
+  // the released trains going from a station to a later one, under [from hsid, dest hsid],
+  // so that query_ticket is one lookup instead of a join of the two station lists.
+  // Kept twice, in the two orders query_ticket prints in, so that its answer is read out
+  // in order and only the seats are looked up.
+  // Filled in ReleaseTrain when STN_PAIR_INDEX is on.
+  StnPairIndex<StnPairTrainInfo::TimeOrder> stn_pair_time_multimap_;
+  StnPairIndex<StnPairTrainInfo::CostOrder> stn_pair_cost_multimap_;
+  // one index handed out per train listed in the station pair indices, so that max_index()
+  // tells whether they miss released trains.
+  ism::IndexPool stn_pair_train_cnt_;
+  // the routes of the released trains, read by the query paths instead of train_hid_train_map_.
+  Timetable timetable_;
+  TransferEngine transfer_engine_ = TransferEngine::HashJoin;
+  ism::WorkStealingPool transfer_pool_;
   ism::Messenger &msgr_;
 };
 
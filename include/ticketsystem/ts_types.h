@@ -7,6 +7,7 @@
 #include "array.h"
 #include "ts_time.h"
 #include "algorithm.h"
+#include "range_kernels.h"
 #include "messenger.h"
 #include "index_pool.h"
 
@@ -235,9 +236,13 @@ using train_hid_t = ism::hash_result_t;
 using hash_stn_name_t = ism::hash_result_t;
 
 class TrainManager;
+class StnPairTrainInfo;
+class Timetable;
 
 class TrainType {
   friend TrainManager;
+  friend StnPairTrainInfo;
+  friend Timetable;
 
 public:
   TrainType() = default;
@@ -260,6 +265,7 @@ public:
     final_date_   = final_date;
     train_type_   = train_type;
     has_released_ = has_released;
+    seat_base_    = ism::NULL_INDEX;
 
     accumulative_price_list_[0] = 0;
     for(stn_num_t i = 0; i < stn_num - 1; ++i)
@@ -276,6 +282,10 @@ public:
   [[nodiscard]]
   ism::hash_result_t hash() const { return train_id_.hash(); }
 
+  seat_num_t max_seat_num() const { return max_seat_num_; }
+  date_md_t start_date() const { return start_date_; }
+  ism::index_t seat_base() const { return seat_base_; }
+
   /**
    * @param train_departure_date the date the train departs from the first station.
    * @return whether this date is within the train's capability.
@@ -327,41 +337,134 @@ private:
   date_md_t       final_date_;
   train_type_t    train_type_;
   bool            has_released_ = false;
+  // the seat status of the run departing on start_date_ + i sits at seat_base_ + i
+  // in the seat calendar. Set on release.
+  ism::index_t    seat_base_ = ism::NULL_INDEX;
 };
 
-class TrainSeatStatus {
+// A train as listed in the station pair index under one of its (from, dest) station pairs:
+// what query_ticket prints and the way to its seats, so that the train itself is not read.
+// Ordered by train; TimeOrder and CostOrder are the orders query_ticket prints in.
+class StnPairTrainInfo {
   friend TrainManager;
+
 public:
+  StnPairTrainInfo() = default;
+  StnPairTrainInfo(const TrainType &train, stn_num_t from_ord, stn_num_t dest_ord)
+    : train_hid_(train.hash()), train_id_(train.train_id_),
+      from_ord_(from_ord), dest_ord_(dest_ord),
+      cost_(train.cost(from_ord, dest_ord)), time_(train.time(from_ord, dest_ord)),
+      departure_time_(train.departure_time_list_[from_ord]), start_time_(train.start_time_),
+      start_date_(train.start_date_), final_date_(train.final_date_),
+      max_seat_num_(train.max_seat_num_), seat_base_(train.seat_base_) {}
+
+  seat_num_t max_seat_num() const { return max_seat_num_; }
+  date_md_t start_date() const { return start_date_; }
+  ism::index_t seat_base() const { return seat_base_; }
+
+  auto operator<=>(const StnPairTrainInfo &other) const { return train_hid_ <=> other.train_hid_; }
+  bool operator==(const StnPairTrainInfo &other) const { return train_hid_ == other.train_hid_; }
+
+  struct TimeOrder {
+    bool operator()(const StnPairTrainInfo &A, const StnPairTrainInfo &B) const {
+      if(A.time_ != B.time_) return A.time_ < B.time_;
+      return A.train_id_ < B.train_id_;
+    }
+  };
+  struct CostOrder {
+    bool operator()(const StnPairTrainInfo &A, const StnPairTrainInfo &B) const {
+      if(A.cost_ != B.cost_) return A.cost_ < B.cost_;
+      return A.train_id_ < B.train_id_;
+    }
+  };
 
-  TrainSeatStatus() = default;
-  void initialize(seat_num_t seat_num, stn_num_t stn_num) {
-    stn_num_ = stn_num;
-     for(size_t j = 0; j < stn_num - 1; ++j)
-       seat_num_list_[j] = seat_num;
+  bool check_train_departure_date(const date_md_t &train_departure_date) const {
+    return start_date_ <= train_departure_date && train_departure_date <= final_date_;
   }
 
-  seat_num_t available_seat_num(stn_num_t from_ord, stn_num_t dest_ord) const {
-    seat_num_t ret = seat_num_list_[from_ord];
-    for(auto i = from_ord + 1; i < dest_ord; ++i)
-      ret = std::min(ret, seat_num_list_[i]);
-    return ret;
+  // see TrainType::get_train_departure_date, with from_ord as the station.
+  date_md_t get_train_departure_date(const date_md_t &passenger_departure_date) const {
+    date_time_t date_time_here(passenger_departure_date, start_time_ + departure_time_);
+    date_time_here -= departure_time_;
+    return date_time_here.date_md();
   }
 
+private:
+  train_hid_t  train_hid_;
+  train_id_t   train_id_;
+  stn_num_t    from_ord_;
+  stn_num_t    dest_ord_;
+  price_t      cost_;
+  time_dur_t   time_;
+  // time cost before departure from the from station.
+  time_dur_t   departure_time_;
+  time_hm_t    start_time_;
+  date_md_t    start_date_;
+  date_md_t    final_date_;
+  seat_num_t   max_seat_num_;
+  ism::index_t seat_base_;
+};
+
+// Unsold seats per segment (from a station to its next), with range-min queries and
+// range updates in O(log stn_num).
+// Trains with at most TREE_SEAT_LIM seats keep a segment tree over the segments in the space of
+// the plain list: node values are 16-bit offsets of a node minimum above its parent's, with the
+// root minimum held apart. Nodes are laid out in preorder, the right child of node v over
+// [lo, hi) being v + 2 * (mid - lo). The others keep the plain list, which is scanned and
+// updated with the vectorized range kernels.
+class TrainSeatStatus {
+  friend TrainManager;
+
+  static constexpr seat_num_t TREE_SEAT_LIM = UINT16_MAX;
+  static constexpr size_t TREE_NODE_CNT = 2 * (MAX_STATION_NUM - 1) - 1;
+
+public:
+
+  TrainSeatStatus() = default;
+  void initialize(seat_num_t seat_num, stn_num_t stn_num);
+
+  // an all-zero record stands for a run nothing was sold on yet, so that seat records are only
+  // written from the first sale on. It has to be initialized before use.
+  bool is_unsold() const { return stn_num_ == 0; }
+
+  seat_num_t available_seat_num(stn_num_t from_ord, stn_num_t dest_ord) const;
+
   void restore_seat_num(seat_num_t seat_num, stn_num_t from_ord, stn_num_t dest_ord) {
-    for(auto i = from_ord; i < dest_ord; ++i)
-      seat_num_list_[i] += seat_num;
+    add_seat_num(seat_num, from_ord, dest_ord);
   }
 
   void consume_seat_num(seat_num_t seat_num, stn_num_t from_ord, stn_num_t dest_ord) {
-    for(auto i = from_ord; i < dest_ord; ++i)
-      seat_num_list_[i] -= seat_num;
+    add_seat_num(-seat_num, from_ord, dest_ord);
   }
 
+  // the unsold seats of every segment, in order.
+  void get_seat_num_list(seat_num_list_t &seat_num_list) const;
+
 private:
-  seat_num_list_t seat_num_list_;
+  void add_seat_num(seat_num_t delta, stn_num_t from_ord, stn_num_t dest_ord);
+
+  // the node v over segments [lo, hi), its offset being rel. Returns its new offset.
+  int tree_add(size_t v, int lo, int hi, int from_ord, int dest_ord, int delta, int rel_v);
+  // the minimum over [from_ord, dest_ord) within node v, whose own minimum is base.
+  int tree_min(size_t v, int lo, int hi, int from_ord, int dest_ord, int base) const;
+  void tree_walk(size_t v, int lo, int hi, int base, seat_num_list_t &seat_num_list) const;
+  // the root has no stored offset.
+  uint16_t& rel(size_t v) { return tree_.rel[v - 1]; }
+  uint16_t rel(size_t v) const { return tree_.rel[v - 1]; }
+
+  union {
+    seat_num_t flat_[MAX_STATION_NUM];
+    struct {
+      seat_num_t root_min;
+      uint16_t rel[TREE_NODE_CNT - 1];
+    } tree_;
+  };
   stn_num_t stn_num_;
+  bool is_tree_;
 };
 
+static_assert(sizeof(TrainSeatStatus) == sizeof(seat_num_list_t) + 2 * sizeof(stn_num_t));
+
 class TicketOrderManager;
 
 class TicketOrderType {
@@ -3,8 +3,7 @@
 
 #include "ts_types.h"
 #include "messenger.h"
-#include "bplustree.h"
-#include "multi_bplustree.h"
+#include "extendible_hash.h"
 
 namespace ticket_system {
 
@@ -40,7 +39,8 @@ public:
 
 private:
 
-  ism::Bplustree<user_hid_t, UserType> user_hid_user_map_;
+  // only ever looked up by exact key.
+  ism::ExtendibleHashTable<user_hid_t, UserType> user_hid_user_map_;
   ism::unordered_map<user_hid_t, LoggedInUserInfo> logged_in_users_;
   ism::Messenger &msgr_;
 };
@@ -1,15 +1,62 @@
 #include <iostream>
 #include <filesystem>
+#include <chrono>
+#include <random>
+#include <string_view>
 
-#include "multi_bplustree.h"
+#include "buffered_multi_bplustree.h"
 #include "ticketsystem.h"
 
 void MultiBptTest();
 void TicketSystemTest();
+void PointLookupBench();
+void WriteAmplificationBench();
+void PageSizeSweepBench();
+void ParallelScanBench();
+void IndexStatsTool();
+void TransferBench();
 
-int main() {
-  TicketSystemTest();
-  return 0;
+// with no argument, runs the ticket system on stdin. The other entry points:
+//   code --index-stats      prints the shape of the indices in ts_data
+//   code --bench <name>     runs one of the benches below
+//   code --multi-bpt-test   runs the multi B+ tree operations read from stdin
+int main(int argc, char **argv) {
+  struct Bench {
+    const char *name;
+    void (*run)();
+  };
+  static constexpr Bench benches[] = {
+    {"point-lookup", PointLookupBench},
+    {"write-amplification", WriteAmplificationBench},
+    {"page-size-sweep", PageSizeSweepBench},
+    {"parallel-scan", ParallelScanBench},
+    {"transfer", TransferBench},
+  };
+  if(argc == 1) {
+    TicketSystemTest();
+    return 0;
+  }
+  std::string_view opt = argv[1];
+  if(opt == "--index-stats" && argc == 2) {
+    IndexStatsTool();
+    return 0;
+  }
+  if(opt == "--multi-bpt-test" && argc == 2) {
+    MultiBptTest();
+    return 0;
+  }
+  if(opt == "--bench" && argc == 3) {
+    for(const auto &bench : benches)
+      if(bench.name == std::string_view(argv[2])) {
+        bench.run();
+        return 0;
+      }
+  }
+  std::cerr << "usage: " << argv[0] << " [--index-stats | --multi-bpt-test | --bench <name>]\nbenches:";
+  for(const auto &bench : benches)
+    std::cerr << ' ' << bench.name;
+  std::cerr << '\n';
+  return 1;
 }
 
 /*********** implementations ************/
@@ -69,6 +116,203 @@ void MultiBptTest() {
   }
 }
 
+// point lookup latency with and without pinned internal levels.
+void PointLookupBench() {
+  using Bpt_t = ism::Bplustree<uint64_t, uint64_t>;
+  constexpr int key_cnt = 200000, lookup_cnt = 2000000;
+  constexpr int buffer_capacity = 1536, replacer_k_arg = 2;
+
+  auto dir = fs::current_path() / "bench_data";
+  fs::remove_all(dir);
+  fs::create_directory(dir);
+  {
+    Bpt_t bpt(dir / "lookup", buffer_capacity, replacer_k_arg);
+    for(uint64_t i = 0; i < key_cnt; ++i)
+      bpt.insert(hash1(std::to_string(i)), i);
+  }
+  for(int budget : {0, buffer_capacity / 4, 0, buffer_capacity / 4}) {
+    Bpt_t bpt(dir / "lookup", buffer_capacity, replacer_k_arg);
+    bpt.pin_internal_levels(budget);
+    std::mt19937 rng(998244353);
+    ism::vector<uint64_t> keys;
+    for(int i = 0; i < lookup_cnt; ++i)
+      keys.push_back(hash1(std::to_string(rng() % key_cnt)));
+    size_t found = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(const auto &key : keys)
+      found += bpt.find(key) != bpt.end();
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start).count();
+    std::cout << "pin budget " << budget << ": " << ns / lookup_cnt << " ns/lookup ("
+              << found << " found)\n";
+  }
+  fs::remove_all(dir);
+}
+
+// page writes and latency of an insert-heavy order-history load, written through vs buffered.
+void WriteAmplificationBench() {
+  struct Record {
+    uint64_t id;
+    char payload[120];
+    bool operator<(const Record &other) const { return id < other.id; }
+  };
+  using MulBpt_t = ism::MultiBplustree<uint64_t, Record>;
+  using BufMulBpt_t = ism::BufferedMultiBplustree<uint64_t, Record>;
+  constexpr int insert_cnt = 200000, user_cnt = 20000;
+  constexpr int buffer_capacity = 64, replacer_k_arg = 2;
+
+  auto dir = fs::current_path() / "bench_data";
+  fs::remove_all(dir);
+  fs::create_directory(dir);
+  std::mt19937 rng(998244353);
+  ism::vector<uint64_t> keys;
+  for(int i = 0; i < insert_cnt; ++i)
+    keys.push_back(hash1(std::to_string(rng() % user_cnt)));
+  auto run = [&](auto &tree, const char *name) {
+    Record record {};
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < insert_cnt; ++i) {
+      record.id = i;
+      tree.insert(keys[i], record);
+    }
+    if constexpr (requires { tree.flush(); })
+      tree.flush();
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start).count();
+    // the frames still dirty (at most buffer_capacity) are left out for both.
+    std::cout << name << ": " << ns / insert_cnt << " ns/insert, "
+              << double(tree.page_write_count()) / insert_cnt << " page writes/insert\n";
+  };
+  {
+    MulBpt_t tree(dir / "plain", buffer_capacity, replacer_k_arg);
+    run(tree, "write-through");
+  }
+  for(size_t message_capacity : {256, 4096}) {
+    BufMulBpt_t tree(dir / ("buffered" + std::to_string(message_capacity)),
+                     buffer_capacity, replacer_k_arg, message_capacity);
+    auto name = "buffered (" + std::to_string(message_capacity) + " messages)";
+    run(tree, name.c_str());
+  }
+  fs::remove_all(dir);
+}
+
+// insertion and lookup cost of one tree geometry, under a fixed buffer memory budget.
+template <class Tree, class ValueT>
+void PageSizeSweepRun(const fs::path &path, const char *name, size_t page_size) {
+  constexpr size_t memory_budget = 4 << 20;
+  constexpr int key_cnt = 100000, lookup_cnt = 500000, replacer_k_arg = 2;
+
+  ism::vector<uint64_t> keys, lookups;
+  std::mt19937 rng(998244353);
+  for(int i = 0; i < key_cnt; ++i)
+    keys.push_back(hash1(std::to_string(i)));
+  for(int i = 0; i < lookup_cnt; ++i)
+    lookups.push_back(keys[rng() % key_cnt]);
+  Tree tree(path, memory_budget / page_size, replacer_k_arg);
+  ValueT value {};
+  auto start = std::chrono::steady_clock::now();
+  for(const auto &key : keys)
+    tree.insert(key, value);
+  auto insert_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - start).count();
+  size_t found = 0;
+  start = std::chrono::steady_clock::now();
+  for(const auto &key : lookups)
+    found += tree.find_upper(key).is_valid();
+  auto lookup_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - start).count();
+  std::cout << name << ", " << page_size / 1024 << "K pages: " << insert_ns / key_cnt << " ns/insert, "
+            << lookup_ns / lookup_cnt << " ns/lookup, "
+            << tree.page_write_count() * page_size / 1024 << " KiB written (" << found << " found)\n";
+}
+
+// the same trees with 4K/16K/64K pages: tiny entries and record-sized values.
+void PageSizeSweepBench() {
+  struct Record {
+    uint64_t id;
+    char payload[120];
+    bool operator<(const Record &other) const { return id < other.id; }
+  };
+  auto dir = fs::current_path() / "bench_data";
+  fs::remove_all(dir);
+  fs::create_directory(dir);
+  auto sweep = [&dir]<size_t page_size>() {
+    using SmallTree_t = ism::Bplustree<uint64_t, uint64_t, std::less<uint64_t>,
+      ism::BptLeafNode<uint64_t, uint64_t, page_size>>;
+    using RecordTree_t = ism::MultiBplustree<uint64_t, Record, std::less<uint64_t>, std::less<Record>,
+      ism::BptLeafNode<uint64_t, Record, page_size>>;
+    auto suffix = std::to_string(page_size);
+    PageSizeSweepRun<SmallTree_t, uint64_t>(dir / ("small" + suffix), "u64 -> u64", page_size);
+    PageSizeSweepRun<RecordTree_t, Record>(dir / ("record" + suffix), "u64 -> 128B record", page_size);
+  };
+  sweep.template operator()<4096>();
+  sweep.template operator()<16384>();
+  sweep.template operator()<65536>();
+  fs::remove_all(dir);
+}
+
+// a full pass over an order-history sized tree: serial iteration against the partitioned scan.
+void ParallelScanBench() {
+  struct Record {
+    uint64_t id;
+    char payload[120];
+    bool operator<(const Record &other) const { return id < other.id; }
+  };
+  struct alignas(64) PartSum {
+    uint64_t sum = 0;
+  };
+  using MulBpt_t = ism::MultiBplustree<uint64_t, Record>;
+  constexpr int insert_cnt = 300000, user_cnt = 30000;
+  constexpr int buffer_capacity = 1024, replacer_k_arg = 2;
+
+  auto dir = fs::current_path() / "bench_data";
+  fs::remove_all(dir);
+  fs::create_directory(dir);
+  {
+    MulBpt_t tree(dir / "orders", buffer_capacity, replacer_k_arg);
+    std::mt19937 rng(998244353);
+    Record record {};
+    for(int i = 0; i < insert_cnt; ++i) {
+      record.id = i;
+      record.payload[i % 120] = char(rng());
+      tree.insert(hash1(std::to_string(rng() % user_cnt)), record);
+    }
+  }
+  // the per-entry work: folds the whole record.
+  auto digest = [](const Record &record) {
+    uint64_t h = record.id;
+    for(char c : record.payload)
+      h = h * 131 + c;
+    return h;
+  };
+  {
+    MulBpt_t tree(dir / "orders", buffer_capacity, replacer_k_arg);
+    uint64_t expected = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(auto it = tree.begin(); it != tree.end(); ++it)
+      expected += digest(it.view().second);
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start).count();
+    std::cout << "serial: " << ns / insert_cnt << " ns/entry\n";
+    for(size_t part_cnt : {1, 2, 4, 8}) {
+      ism::vector<PartSum> sums;
+      sums.resize(part_cnt);
+      start = std::chrono::steady_clock::now();
+      auto parts = tree.parallel_scan(part_cnt, [&](size_t part, const uint64_t &, const Record &record) {
+        sums[part].sum += digest(record);
+      });
+      ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+      uint64_t total = 0;
+      for(const auto &part_sum : sums)
+        total += part_sum.sum;
+      std::cout << parts << " parts: " << ns / insert_cnt << " ns/entry"
+                << (total == expected ? "" : " (digest mismatch)") << "\n";
+    }
+  }
+  fs::remove_all(dir);
+}
+
 namespace ts = ticket_system;
 
 void TicketSystemTest() {
@@ -80,4 +324,82 @@ void TicketSystemTest() {
   std::cin.tie(nullptr);
   ts::TicketSystem ticket_system(name_base);
   ticket_system.work_loop();
-}
\ No newline at end of file
+}
+
+// prints the shape of the indices of the data in ts_data, without running any command.
+void IndexStatsTool() {
+  auto name_base = fs::current_path() / "ts_data" / "ts";
+  ts::TicketSystem ticket_system(name_base);
+  ticket_system.report_index_stats(std::cout);
+}
+
+// query_transfer on a dense station graph: every train stops at a large share of few stations,
+// so each interval station pairs many trains. Both transfer engines answer the same queries.
+void TransferBench() {
+  constexpr int stn_cnt = 40, train_cnt = 300, query_cnt = 300;
+  constexpr int min_stn_num = 15, max_stn_num = 30;
+
+  auto dir = fs::current_path() / "bench_data";
+  fs::remove_all(dir);
+  fs::create_directory(dir);
+  {
+    ism::Messenger msgr;
+    ts::TrainManager train_mgr(dir / "ts", msgr);
+    std::mt19937 rng(998244353);
+    auto stn_name = [](int stn) { return ts::stn_name_t("stn" + std::to_string(stn)); };
+    static ts::TrainType train;
+    static ts::stn_list_t stn_list;
+    static ts::price_list_t price_list;
+    static ts::dur_list_t travel_time_list, stopover_time_list;
+    ism::vector<int> stns;
+    for(int i = 0; i < stn_cnt; ++i)
+      stns.push_back(i);
+    for(int i = 0; i < train_cnt; ++i) {
+      ts::stn_num_t stn_num = min_stn_num + rng() % (max_stn_num - min_stn_num + 1);
+      for(int j = stn_cnt - 1; j > 0; --j)
+        std::swap(stns[j], stns[rng() % (j + 1)]);
+      for(int j = 0; j < stn_num; ++j) {
+        stn_list[j] = stn_name(stns[j]);
+        price_list[j] = 1 + rng() % 1000;
+        travel_time_list[j] = ts::time_dur_t(1 + rng() % 300);
+        stopover_time_list[j] = ts::time_dur_t(1 + rng() % 20);
+      }
+      auto begin_date = ts::date_md_t(ts::days(rng() % 30));
+      auto train_id = ts::train_id_t("train" + std::to_string(i));
+      train.initialize(
+        train_id, stn_num, 100000, stn_list, price_list,
+        ts::time_hm_t(ts::minutes(rng() % 1440)), travel_time_list, stopover_time_list,
+        begin_date, begin_date + ts::days(30 + rng() % 60), 'G', false);
+      train_mgr.AddTrain(train);
+      train_mgr.ReleaseTrain(train_id);
+    }
+    struct Query {
+      ts::stn_name_t from_stn, dest_stn;
+      ts::date_md_t date;
+      bool is_cost_order;
+    };
+    ism::vector<Query> queries;
+    for(int i = 0; i < query_cnt; ++i) {
+      int from = rng() % stn_cnt, dest = (from + 1 + rng() % (stn_cnt - 1)) % stn_cnt;
+      queries.push_back(Query{stn_name(from), stn_name(dest), ts::date_md_t(ts::days(rng() % 92)), bool(rng() % 2)});
+    }
+    std::string answers[2];
+    auto run = [&](ts::TrainManager::TransferEngine engine, const char *name, std::string &answer) {
+      train_mgr.set_transfer_engine(engine);
+      msgr.reset();
+      auto start = std::chrono::steady_clock::now();
+      for(const auto &query : queries)
+        train_mgr.QueryTransfer(query.from_stn, query.dest_stn, query.date, query.is_cost_order);
+      auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+      std::cout << name << ": " << us / query_cnt << " us/query\n";
+      answer = msgr.str();
+    };
+    run(ts::TrainManager::TransferEngine::MergeJoin, "merge join", answers[0]);
+    run(ts::TrainManager::TransferEngine::HashJoin, "hash join", answers[1]);
+    if(answers[0] != answers[1])
+      std::cout << "answers differ\n";
+    msgr.reset();
+  }
+  fs::remove_all(dir);
+}
@@ -0,0 +1,90 @@
+#include "bloom_filter.h"
+
+namespace insomnia {
+
+static constexpr size_t MIN_CAPACITY = 1024;
+
+BloomFilter::BloomFilter(size_t bits_per_key)
+  : bits_per_key_(bits_per_key), probe_cnt_(0), bit_cnt_(0), key_cnt_(0), capacity_(0) {
+  if(bits_per_key_ == 0)
+    throw algorithm_exception("Bloom filter needs at least a bit per key.");
+  // k = ln2 * bits per key minimizes the false positive rate.
+  probe_cnt_ = std::clamp(static_cast<int>(bits_per_key_ * 69 / 100), 1, 16);
+  reset(MIN_CAPACITY);
+}
+
+void BloomFilter::reset(size_t capacity) {
+  capacity_ = std::max(capacity, MIN_CAPACITY);
+  bit_cnt_ = (capacity_ * bits_per_key_ + 63) / 64 * 64;
+  words_.clear();
+  words_.resize(bit_cnt_ / 64, 0);
+  key_cnt_ = 0;
+}
+
+hash_result_t BloomFilter::mix(hash_result_t x) {
+  // splitmix64 finalizer: the keys are often hashes already, but not always well spread ones.
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  x ^= x >> 31;
+  return x;
+}
+
+void BloomFilter::insert(hash_result_t hash) {
+  hash = mix(hash);
+  hash_result_t h1 = hash & 0xffffffffull, h2 = (hash >> 32) | 1;
+  for(int i = 0; i < probe_cnt_; ++i) {
+    size_t bit = (h1 + i * h2) % bit_cnt_;
+    words_[bit / 64] |= uint64_t(1) << (bit % 64);
+  }
+  ++key_cnt_;
+}
+
+bool BloomFilter::may_contain(hash_result_t hash) const {
+  hash = mix(hash);
+  hash_result_t h1 = hash & 0xffffffffull, h2 = (hash >> 32) | 1;
+  for(int i = 0; i < probe_cnt_; ++i) {
+    size_t bit = (h1 + i * h2) % bit_cnt_;
+    if(!(words_[bit / 64] >> (bit % 64) & 1))
+      return false;
+  }
+  return true;
+}
+
+void BloomFilter::save(const std::filesystem::path &path) const {
+  std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+  if(!ofs.is_open())
+    throw algorithm_exception("Bloom filter failed to save.");
+  ofs.write(reinterpret_cast<const char*>(&bits_per_key_), sizeof(size_t));
+  ofs.write(reinterpret_cast<const char*>(&key_cnt_), sizeof(size_t));
+  ofs.write(reinterpret_cast<const char*>(&capacity_), sizeof(size_t));
+  ofs.write(reinterpret_cast<const char*>(words_.data()), words_.size() * sizeof(uint64_t));
+}
+
+bool BloomFilter::load(const std::filesystem::path &path) {
+  if(!std::filesystem::exists(path))
+    return false;
+  size_t bits_per_key = 0, key_cnt = 0, capacity = 0;
+  {
+    std::ifstream ifs(path, std::ios::binary);
+    ifs.read(reinterpret_cast<char*>(&bits_per_key), sizeof(size_t));
+    ifs.read(reinterpret_cast<char*>(&key_cnt), sizeof(size_t));
+    ifs.read(reinterpret_cast<char*>(&capacity), sizeof(size_t));
+    if(ifs && bits_per_key == bits_per_key_ && capacity >= MIN_CAPACITY) {
+      reset(capacity);
+      ifs.read(reinterpret_cast<char*>(words_.data()), words_.size() * sizeof(uint64_t));
+      key_cnt_ = key_cnt;
+      if(!ifs) {
+        reset(MIN_CAPACITY);
+        bits_per_key = 0;
+      }
+    } else {
+      bits_per_key = 0;
+    }
+  }
+  std::filesystem::remove(path);
+  return bits_per_key == bits_per_key_;
+}
+
+}
@@ -0,0 +1,111 @@
+#include "range_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define INSOMNIA_RANGE_KERNELS_X86
+#endif
+
+namespace insomnia {
+
+static int32_t range_min_scalar(const int32_t *data, size_t n) {
+  int32_t ret = INT32_MAX;
+  for(size_t i = 0; i < n; ++i)
+    ret = (data[i] < ret ? data[i] : ret);
+  return ret;
+}
+
+static void range_add_scalar(int32_t *data, size_t n, int32_t delta) {
+  for(size_t i = 0; i < n; ++i)
+    data[i] += delta;
+}
+
+#ifdef INSOMNIA_RANGE_KERNELS_X86
+
+// 8 zeros, 8 ones, 8 zeros: lanes [off, 8) set at MASK_TABLE + 8 - off,
+// lanes [0, k) set at MASK_TABLE + 16 - k.
+alignas(32) static const int32_t MASK_TABLE[24] = {
+  0, 0, 0, 0, 0, 0, 0, 0,
+  -1, -1, -1, -1, -1, -1, -1, -1,
+  0, 0, 0, 0, 0, 0, 0, 0
+};
+
+// the lanes of the vector at base that fall into [beg, end).
+__attribute__((target("avx2")))
+static __m256i lane_mask(const int32_t *base, const int32_t *beg, const int32_t *end) {
+  auto head = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(MASK_TABLE + 8 - (beg > base ? beg - base : 0)));
+  if(end - base >= 8)
+    return head;
+  auto tail = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(MASK_TABLE + 16 - (end - base)));
+  return _mm256_and_si256(head, tail);
+}
+
+static const int32_t* align_down(const int32_t *ptr) {
+  return reinterpret_cast<const int32_t*>(reinterpret_cast<uintptr_t>(ptr) & ~uintptr_t(31));
+}
+
+__attribute__((target("avx2")))
+static int32_t range_min_avx2(const int32_t *data, size_t n) {
+  if(n == 0)
+    return INT32_MAX;
+  const int32_t *end = data + n;
+  const int32_t *base = align_down(data);
+  const auto fill = _mm256_set1_epi32(INT32_MAX);
+  // masked-off lanes are not read, so the vector may stick out of the run.
+  auto mask = lane_mask(base, data, end);
+  auto vmin = _mm256_blendv_epi8(fill, _mm256_maskload_epi32(base, mask), mask);
+  for(base += 8; base + 8 <= end; base += 8)
+    vmin = _mm256_min_epi32(vmin, _mm256_load_si256(reinterpret_cast<const __m256i*>(base)));
+  if(base < end) {
+    mask = lane_mask(base, base, end);
+    vmin = _mm256_min_epi32(vmin, _mm256_blendv_epi8(fill, _mm256_maskload_epi32(base, mask), mask));
+  }
+  auto half = _mm_min_epi32(_mm256_castsi256_si128(vmin), _mm256_extracti128_si256(vmin, 1));
+  half = _mm_min_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+  half = _mm_min_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(half);
+}
+
+__attribute__((target("avx2")))
+static void range_add_avx2(int32_t *data, size_t n, int32_t delta) {
+  if(n == 0)
+    return;
+  int32_t *end = data + n;
+  auto base = const_cast<int32_t*>(align_down(data));
+  const auto vdelta = _mm256_set1_epi32(delta);
+  auto mask = lane_mask(base, data, end);
+  _mm256_maskstore_epi32(base, mask, _mm256_add_epi32(_mm256_maskload_epi32(base, mask), vdelta));
+  for(base += 8; base + 8 <= end; base += 8) {
+    auto ptr = reinterpret_cast<__m256i*>(base);
+    _mm256_store_si256(ptr, _mm256_add_epi32(_mm256_load_si256(ptr), vdelta));
+  }
+  if(base < end) {
+    mask = lane_mask(base, base, end);
+    _mm256_maskstore_epi32(base, mask, _mm256_add_epi32(_mm256_maskload_epi32(base, mask), vdelta));
+  }
+}
+
+static bool has_avx2() {
+  static const bool ret = __builtin_cpu_supports("avx2");
+  return ret;
+}
+
+int32_t range_min(const int32_t *data, size_t n) {
+  return has_avx2() ? range_min_avx2(data, n) : range_min_scalar(data, n);
+}
+
+void range_add(int32_t *data, size_t n, int32_t delta) {
+  if(has_avx2())
+    range_add_avx2(data, n, delta);
+  else
+    range_add_scalar(data, n, delta);
+}
+
+#else
+
+int32_t range_min(const int32_t *data, size_t n) { return range_min_scalar(data, n); }
+
+void range_add(int32_t *data, size_t n, int32_t delta) { range_add_scalar(data, n, delta); }
+
+#endif
+
+}
@@ -0,0 +1,116 @@
+#include "work_stealing_pool.h"
+
+namespace insomnia {
+
+WorkStealingPool::WorkStealingPool(size_t worker_cnt)
+  : worker_cnt_(std::max<size_t>(worker_cnt, 1)), ranges_(new TaskRange[worker_cnt_]) {
+  threads_.reserve(worker_cnt_ - 1);
+  for(size_t worker = 1; worker < worker_cnt_; ++worker)
+    threads_.emplace_back(&WorkStealingPool::thread_loop, this, worker);
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  {
+    std::lock_guard<std::mutex> lock(batch_latch_);
+    stopping_ = true;
+  }
+  batch_cv_.notify_all();
+  for(auto &thread : threads_)
+    thread.join();
+}
+
+void WorkStealingPool::run_batch(size_t task_cnt, task_fn_t call, void *ctx) {
+  if(task_cnt == 0)
+    return;
+  if(worker_cnt_ == 1 || task_cnt == 1) {
+    for(size_t task = 0; task < task_cnt; ++task)
+      call(ctx, 0, task);
+    return;
+  }
+  // the threads are asleep: the ranges are published by the latch below.
+  for(size_t worker = 0; worker < worker_cnt_; ++worker) {
+    ranges_[worker].beg = task_cnt * worker / worker_cnt_;
+    ranges_[worker].end = task_cnt * (worker + 1) / worker_cnt_;
+  }
+  {
+    std::lock_guard<std::mutex> lock(batch_latch_);
+    call_ = call;
+    ctx_ = ctx;
+    error_ = nullptr;
+    busy_cnt_ = worker_cnt_ - 1;
+    ++generation_;
+  }
+  batch_cv_.notify_all();
+  work(0);
+  std::exception_ptr error;
+  {
+    std::unique_lock<std::mutex> lock(batch_latch_);
+    done_cv_.wait(lock, [this] { return busy_cnt_ == 0; });
+    std::swap(error, error_);
+  }
+  if(error)
+    std::rethrow_exception(error);
+}
+
+void WorkStealingPool::thread_loop(size_t worker) {
+  size_t seen_generation = 0;
+  while(true) {
+    {
+      std::unique_lock<std::mutex> lock(batch_latch_);
+      batch_cv_.wait(lock, [&] { return stopping_ || generation_ != seen_generation; });
+      if(stopping_)
+        return;
+      seen_generation = generation_;
+    }
+    work(worker);
+    std::lock_guard<std::mutex> lock(batch_latch_);
+    if(--busy_cnt_ == 0)
+      done_cv_.notify_one();
+  }
+}
+
+void WorkStealingPool::work(size_t worker) {
+  size_t task;
+  while(next_task(worker, task)) {
+    try {
+      call_(ctx_, worker, task);
+    } catch(...) {
+      std::lock_guard<std::mutex> lock(batch_latch_);
+      if(!error_)
+        error_ = std::current_exception();
+    }
+  }
+}
+
+bool WorkStealingPool::next_task(size_t worker, size_t &task) {
+  auto &own = ranges_[worker];
+  {
+    std::lock_guard<std::mutex> lock(own.latch);
+    if(own.beg < own.end) {
+      task = own.beg++;
+      return true;
+    }
+  }
+  // the stolen tasks are out of every range until put into the own one; whoever misses them
+  // meanwhile may finish early, as this worker runs them anyway.
+  for(size_t i = 1; i < worker_cnt_; ++i) {
+    auto &victim = ranges_[(worker + i) % worker_cnt_];
+    size_t beg, end;
+    {
+      std::lock_guard<std::mutex> lock(victim.latch);
+      if(victim.beg == victim.end)
+        continue;
+      end = victim.end;
+      beg = end - (end - victim.beg + 1) / 2;
+      victim.end = beg;
+    }
+    task = beg;
+    std::lock_guard<std::mutex> lock(own.latch);
+    own.beg = beg + 1;
+    own.end = end;
+    return true;
+  }
+  return false;
+}
+
+}
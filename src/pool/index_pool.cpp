@@ -36,6 +36,35 @@ void IndexPool::dealloc(index_t index) {
   unallocated_.push_back(index);
 }
 
+bool IndexPool::acquire(index_t index) {
+  if(index <= NULL_INDEX)
+    throw pool_exception("Acquiring definitely invalid index.");
+  if(index > max_index_) {
+    while(++max_index_ < index)
+      unallocated_.push_back(max_index_);
+    return true;
+  }
+  for(size_t i = 0; i < unallocated_.size(); ++i) {
+    if(unallocated_[i] == index) {
+      unallocated_[i] = unallocated_.back();
+      unallocated_.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
+
+void IndexPool::truncate(index_t max_index) {
+  if(max_index >= max_index_)
+    return;
+  size_t kept = 0;
+  for(size_t i = 0; i < unallocated_.size(); ++i)
+    if(unallocated_[i] <= max_index)
+      unallocated_[kept++] = unallocated_[i];
+  unallocated_.resize(kept);
+  max_index_ = max_index;
+}
+
 void IndexPool::load() {
   fstream_.seekg(0);
   fstream_.read(reinterpret_cast<char*>(&max_index_), sizeof(index_t));
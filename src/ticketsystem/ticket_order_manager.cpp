@@ -3,12 +3,25 @@
 namespace ticket_system {
 
 static constexpr int BUF_CAPA = 150, K_DIST = 2;
+// internal nodes kept resident per tree, out of BUF_CAPA frames.
+static constexpr int PIN_BUDGET = BUF_CAPA / 3;
+
+template <class Tree>
+static Tree open_order_map(const std::string &path, size_t message_capacity) {
+  if constexpr(requires { Tree(path, BUF_CAPA, K_DIST, message_capacity); })
+    return Tree(path, BUF_CAPA, K_DIST, message_capacity);
+  else
+    return Tree(path, BUF_CAPA, K_DIST);
+}
 
 TicketOrderManager::TicketOrderManager(std::filesystem::path path, ism::Messenger &msgr)
 : index_pool_(path.string() + "-order_id"),
-  user_hid_order_map_(path.string() + "-huid_order", BUF_CAPA, K_DIST),
-  train_hid_order_map_(path.string() + "-htid_order", BUF_CAPA, K_DIST),
-  msgr_(msgr) {}
+  user_hid_order_map_(open_order_map<huid_order_multbpt>(path.string() + "-huid_order", ORDER_MAP_MESSAGE_CAPACITY)),
+  train_hid_order_map_(open_order_map<htid_order_multbpt>(path.string() + "-htid_order", ORDER_MAP_MESSAGE_CAPACITY)),
+  msgr_(msgr) {
+  user_hid_order_map_.pin_internal_levels(PIN_BUDGET);
+  train_hid_order_map_.pin_internal_levels(PIN_BUDGET);
+}
 
 void TicketOrderManager::record_buy_ticket(TicketOrderType &ticket_order) {
   ticket_order.order_id_ = new_order_id();
@@ -19,24 +32,20 @@ void TicketOrderManager::record_buy_ticket(TicketOrderType &ticket_order) {
 }
 
 void TicketOrderManager::QueryOrder(const username_t &username) {
-  auto order_list = user_hid_order_map_.search(username.hash());
-  msgr_ << order_list.size() << '\n';
-  for(auto &order : order_list) {
+  auto huid = username.hash();
+  size_t order_cnt = 0;
+  user_hid_order_map_.for_each_equal(huid, [&order_cnt](const TicketOrderType &) { ++order_cnt; });
+  msgr_ << order_cnt << '\n';
+  user_hid_order_map_.for_each_equal(huid, [this](const TicketOrderType &order) {
     msgr_ << order << '\n';
-  }
+  });
 }
 
-insomnia::MultiBplustree<unsigned long, TicketOrderType, std::less<>, std::greater<>>::iterator
+TicketOrderManager::huid_order_multbpt::iterator
 TicketOrderManager::find_order_iter(const username_t &username, order_id_t order_rank) {
-  auto huid = username.hash();
-  order_id_t rank = 0;
-  auto it = user_hid_order_map_.find_upper(huid);
-  while(it != user_hid_order_map_.end() && it.view().first == huid) {
-    if(++rank == order_rank)
-      return it;
-    ++it;
-  }
-  return huid_order_multbpt::iterator();
+  if(order_rank <= 0)
+    return huid_order_multbpt::iterator();
+  return user_hid_order_map_.find_nth(username.hash(), order_rank - 1);
 }
 
 void TicketOrderManager::update_user_order_stat(const TicketOrderType &ticket_order) {
@@ -57,26 +66,33 @@ void TicketOrderManager::recover_ticket(const TicketOrderType &refunded_ticket_o
   auto key = ism::make_pair(
       refunded_ticket_order.train_id().hash(),
       refunded_ticket_order.train_dep_date().count());
-  for(auto it = train_hid_order_map_.find_upper(key);
-      it != train_hid_order_map_.end() && it.view().first == key; ++it) {
-    auto &train_order_view = it.view().second;
-    if(!train_order_view.is_pending()) continue;
-    if(train_order_view.ticket_num() >
-       seat_status.available_seat_num(train_order_view.from_stn_ord(), train_order_view.dest_stn_ord()))
-      continue;
-    auto &train_order = (*it).second;
-    train_order.set_success();
-    seat_status.consume_seat_num(train_order.ticket_num(), train_order.from_stn_ord(), train_order.dest_stn_ord());
-
-    update_user_order_stat(train_order);
-  }
+  train_hid_order_map_.scan(key, key,
+    [&seat_status](const auto &, const TicketOrderType &train_order) {
+      return train_order.is_pending() &&
+        train_order.ticket_num() <=
+          seat_status.available_seat_num(train_order.from_stn_ord(), train_order.dest_stn_ord());
+    }, SIZE_MAX,
+    [this, &seat_status](const auto &, TicketOrderType &train_order) {
+      train_order.set_success();
+      seat_status.consume_seat_num(train_order.ticket_num(), train_order.from_stn_ord(), train_order.dest_stn_ord());
+      update_user_order_stat(train_order);
+    });
 }
 
-
 void TicketOrderManager::clean() {
   index_pool_.clear();
   user_hid_order_map_.clear();
   train_hid_order_map_.clear();
 }
 
+void TicketOrderManager::report_index_stats(std::ostream &os) {
+  os << "[user -> orders]\n" << user_hid_order_map_.stats();
+  os << "[train, date -> orders]\n" << train_hid_order_map_.stats();
+}
+
+void TicketOrderManager::compact_step(size_t budget) {
+  user_hid_order_map_.compact_step(budget);
+  train_hid_order_map_.compact_step(budget);
+}
+
 }
\ No newline at end of file
@@ -47,6 +47,10 @@ void TicketSystem::run() {
   } else throw ism::invalid_argument(std::string("unknown command:" + std::string(cmd_name)).c_str());
   msgr_.print_msg();
   msgr_.reset();
+  if(++command_cnt_ % COMPACT_PERIOD == 0) {
+    train_mgr_.compact_step(COMPACT_BUDGET);
+    order_mgr_.compact_step(COMPACT_BUDGET);
+  }
 }
 
 void TicketSystem::AddUser() {
@@ -176,9 +180,9 @@ void TicketSystem::RefundTicket() {
   }
   auto &user_target_order = (*user_target_order_iter).second;
 
-  auto seat_status_iter = train_mgr_.get_seat_status_iter(
+  auto seat_status_visitor = train_mgr_.get_seat_status_visitor(
     user_target_order.train_id(), user_target_order.train_dep_date());
-  auto &seat_status = (*seat_status_iter).second;
+  auto &seat_status = *seat_status_visitor.as_mut();
 
   // refund target order
   if(user_target_order.is_succeeded()) // It doesn't affect test2(basic2?)
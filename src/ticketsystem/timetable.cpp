@@ -0,0 +1,42 @@
+#include "timetable.h"
+
+namespace ticket_system {
+
+void Timetable::add(const TrainType &train) {
+  auto route_beg = stn_hids_.size();
+  trains_.push_back(Train{
+    train.hash(), train.train_id_, train.stn_num_, train.max_seat_num_,
+    train.start_time_, train.start_date_, train.final_date_, train.seat_base_, route_beg});
+  slot_map_[train.hash()] = trains_.size() - 1;
+  for(stn_num_t i = 0; i < train.stn_num_; ++i) {
+    stn_hids_.push_back(train.stn_list_[i].hash());
+    departure_times_.push_back(train.departure_time_list_[i]);
+    arrival_times_.push_back(train.arrival_time_list_[i]);
+    prices_.push_back(train.accumulative_price_list_[i]);
+  }
+}
+
+TrainRoute Timetable::find(train_hid_t train_hid) {
+  TrainRoute route;
+  auto it = slot_map_.find(train_hid);
+  if(it == slot_map_.end())
+    return route;
+  route.train_ = &trains_[it->second];
+  auto beg = route.train_->route_beg;
+  route.stn_hids_ = stn_hids_.data() + beg;
+  route.departure_times_ = departure_times_.data() + beg;
+  route.arrival_times_ = arrival_times_.data() + beg;
+  route.prices_ = prices_.data() + beg;
+  return route;
+}
+
+void Timetable::clear() {
+  trains_.clear();
+  slot_map_.clear();
+  stn_hids_.clear();
+  departure_times_.clear();
+  arrival_times_.clear();
+  prices_.clear();
+}
+
+}
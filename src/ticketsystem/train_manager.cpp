@@ -1,14 +1,62 @@
+#include <atomic>
+#include <climits>
 #include "train_manager.h"
 
 namespace ticket_system {
 
 static constexpr int BUF_CAPA = 150, K_DIST = 2;
+// internal nodes kept resident per tree, out of BUF_CAPA frames.
+static constexpr int PIN_BUDGET = BUF_CAPA / 3;
+// Bloom filter bits per train id, so that adding a new train mostly skips the index descent.
+static constexpr size_t FILTER_BITS = 10;
+// answer query_ticket from the station pair index. A release then inserts
+// stn_num * (stn_num - 1) / 2 entries there.
+static constexpr bool STN_PAIR_INDEX = true;
+// query_transfer searches the interval stations on up to this many threads, the caller included,
+// once it has at least PARALLEL_TRANSFER_PAIRS leg pairs to look at.
+static constexpr size_t TRANSFER_WORKERS = 4;
+static constexpr size_t PARALLEL_TRANSFER_PAIRS = 4096;
+
+static size_t transfer_worker_count() {
+  return std::clamp<size_t>(std::thread::hardware_concurrency(), 1, TRANSFER_WORKERS);
+}
 
 TrainManager::TrainManager(std::filesystem::path path, ism::Messenger &msgr)
-: train_hid_train_map_(path.string() + "-htid", BUF_CAPA, K_DIST),
-  train_hid_seats_map_(path.string() + "-htid_seats", BUF_CAPA, K_DIST),
+: train_hid_train_map_(path.string() + "-htid", BUF_CAPA, K_DIST, FILTER_BITS),
+  seat_calendar_(path.string() + "-seat_calendar", BUF_CAPA, K_DIST),
   stn_hid_train_info_multimap_(path.string() + "-stn_htid", BUF_CAPA, K_DIST),
-  msgr_(msgr) {}
+  stn_pair_time_multimap_(path.string() + "-stn_pair_time", BUF_CAPA, K_DIST),
+  stn_pair_cost_multimap_(path.string() + "-stn_pair_cost", BUF_CAPA, K_DIST),
+  stn_pair_train_cnt_(path.string() + "-stn_pair_cnt"),
+  transfer_pool_(transfer_worker_count()),
+  msgr_(msgr) {
+  // the trains used to sit in the leaves of a Bplustree under "-htid-bpt". Data in that layout
+  // cannot be read any more, and starting over would silently drop every train.
+  if(train_hid_train_map_.empty() && std::filesystem::exists(path.string() + "-htid-bpt.dat"))
+    throw ism::database_exception("train data in the layout before the out-of-line train map, "
+                                  "remove the data directory to start over");
+  train_hid_train_map_.pin_internal_levels(PIN_BUDGET);
+  stn_hid_train_info_multimap_.pin_internal_levels(PIN_BUDGET);
+  stn_pair_time_multimap_.pin_internal_levels(PIN_BUDGET);
+  stn_pair_cost_multimap_.pin_internal_levels(PIN_BUDGET);
+  // the single station pair index written before the two ordered ones.
+  std::filesystem::remove(path.string() + "-stn_pair-mult_bpt.dat");
+  std::filesystem::remove(path.string() + "-stn_pair-mult_bpt.dat.idx");
+  for(auto it = train_hid_train_map_.begin(); it != train_hid_train_map_.end(); ++it)
+    if(const auto &train = it.view().second; train.has_released_)
+      timetable_.add(train);
+  // the station pair indices are rebuilt if they miss released trains, e.g. the ones
+  // released while STN_PAIR_INDEX was off.
+  if constexpr(STN_PAIR_INDEX)
+    if(static_cast<size_t>(stn_pair_train_cnt_.max_index()) != timetable_.size()) {
+      stn_pair_time_multimap_.clear();
+      stn_pair_cost_multimap_.clear();
+      stn_pair_train_cnt_.clear();
+      for(auto it = train_hid_train_map_.begin(); it != train_hid_train_map_.end(); ++it)
+        if(const auto &train = it.view().second; train.has_released_)
+          index_stn_pairs(train);
+    }
+}
 
 void TrainManager::AddTrain(const TrainType &train) {
   auto htid = train.hash();
@@ -51,11 +99,11 @@ void TrainManager::ReleaseTrain(const train_id_t &train_id) {
   for(stn_num_t i = 0; i < train.stn_num_; ++i)
     stn_hid_train_info_multimap_.insert(
       train.stn_list_[i].hash(), ism::pair<train_hid_t, stn_num_t>(htid, i));
-  static TrainSeatStatus train_seat_status;
-  train_seat_status.initialize(train.max_seat_num_, train.stn_num_);
-  for(days_count_t i = train.start_date_.count(); i <= train.final_date_.count(); ++i)
-    train_hid_seats_map_.insert(
-      ism::make_pair(i, htid), train_seat_status);
+  // the records stay unsold (zeros) until the first ticket of their day.
+  train.seat_base_ = seat_calendar_.alloc(train.final_date_.count() - train.start_date_.count() + 1);
+  if constexpr(STN_PAIR_INDEX)
+    index_stn_pairs(train);
+  timetable_.add(train);
     msgr_ << "0\n";
 }
 
@@ -73,13 +121,12 @@ void TrainManager::QueryTrain(const train_id_t &train_id, date_md_t train_depart
   }
 
   static seat_num_list_t seat_num_list;
+  for(size_t i = 0; i < train.stn_num_; ++i)
+    seat_num_list[i] = train.max_seat_num_;
   if(train.has_released_) {
-    auto it2 = train_hid_seats_map_.find(
-      ism::make_pair(train_departure_date.count(), htid));
-    seat_num_list = (*it2).second.seat_num_list_;
-  } else {
-    for(size_t i = 0; i < train.stn_num_; ++i)
-      seat_num_list[i] = train.max_seat_num_;
+    auto seat_visitor = seat_status_visitor(train, train_departure_date);
+    if(!seat_visitor.as()->is_unsold())
+      seat_visitor.as()->get_seat_num_list(seat_num_list);
   }
 
   // train info
@@ -113,74 +160,77 @@ void TrainManager::QueryTicket(
   auto from_hsid = from_stn.hash();
   auto dest_hsid = dest_stn.hash();
 
-  // already sorted in terms of htid.
-  const auto from_train_list = stn_hid_train_info_multimap_.search(from_hsid);
-  const auto dest_train_list = stn_hid_train_info_multimap_.search(dest_hsid);
-
-  // It's said that this goes against compilation... But I haven't seen it yet.
+  // what a line of the answer needs. The lines are formatted straight into msgr_ once the
+  // results are all in order, so that sorting moves no strings.
   struct QueryResultType {
-    std::string msg;
+    train_id_t  train_id;
+    date_time_t departure_date_time;
     time_dur_t  time;
     price_t     cost;
-    train_id_t  train_id;
-
-    QueryResultType() = default;
-    QueryResultType(std::string _msg, time_dur_t _time, price_t _cost, train_id_t _train_id)
-      : msg(std::move(_msg)), time(_time), cost(_cost), train_id(_train_id) {}
+    seat_num_t  seat_num;
   };
 
   ism::vector<QueryResultType> ret_vec;
 
-  for(size_t from_ptr = 0, dest_ptr = 0;
-      from_ptr < from_train_list.size() && dest_ptr < dest_train_list.size(); ) {
-    const auto &[from_train_hid, from_ord] = from_train_list[from_ptr];
-    const auto &[dest_train_hid, dest_ord] = dest_train_list[dest_ptr];
-    if(from_train_hid < dest_train_hid) { ++from_ptr; continue; }
-    if(from_train_hid > dest_train_hid) { ++dest_ptr; continue; }
-    if(from_ord > dest_ord) { ++from_ptr; ++dest_ptr; continue; }
+  auto add_result = [&](const StnPairTrainInfo &info) {
+    // check: if the train covers the passenger departure date.
+    auto train_departure_date = info.get_train_departure_date(passenger_departure_date);
+    if(!info.check_train_departure_date(train_departure_date))
+      return;
+    ret_vec.push_back(QueryResultType{
+      info.train_id_, date_time_t(train_departure_date, info.start_time_) + info.departure_time_,
+      info.time_, info.cost_,
+      available_seat_num(info, train_departure_date, info.from_ord_, info.dest_ord_)});
+  };
 
-    const auto it = train_hid_train_map_.find(dest_train_hid);
-    const auto &train = (*it).second;
+  if constexpr(STN_PAIR_INDEX) {
+    // the index is in the order of the answer.
+    auto stn_pair = ism::make_pair(from_hsid, dest_hsid);
+    if(is_cost_order)
+      stn_pair_cost_multimap_.for_each_equal(stn_pair, add_result);
+    else
+      stn_pair_time_multimap_.for_each_equal(stn_pair, add_result);
+  } else {
+    // already sorted in terms of htid.
+    auto from_cursor = stn_hid_train_info_multimap_.equal_range(from_hsid);
+    auto dest_cursor = stn_hid_train_info_multimap_.equal_range(dest_hsid);
+
+    while(from_cursor.is_valid() && dest_cursor.is_valid()) {
+      const auto &[from_train_hid, from_ord] = *from_cursor;
+      const auto &[dest_train_hid, dest_ord] = *dest_cursor;
+      if(from_train_hid < dest_train_hid) { ++from_cursor; continue; }
+      if(from_train_hid > dest_train_hid) { ++dest_cursor; continue; }
+      if(from_ord > dest_ord) { ++from_cursor; ++dest_cursor; continue; }
+
+      add_result(stn_pair_info(timetable_.find(dest_train_hid), from_ord, dest_ord));
+      ++from_cursor; ++dest_cursor;
+    }
 
-    // check: if the train covers the passenger departure date.
-    auto train_departure_date = train.get_train_departure_date(passenger_departure_date, from_ord);
-    if(!train.check_train_departure_date(train_departure_date)) { ++from_ptr; ++dest_ptr; continue; }
-
-    date_time_t train_departure_date_time(train_departure_date, train.start_time_);
-    auto time = train.arrival_time_list_[dest_ord] - train.departure_time_list_[from_ord];
-    auto cost = train.accumulative_price_list_[dest_ord] - train.accumulative_price_list_[from_ord];
-    auto seats_it = train_hid_seats_map_.find(
-      ism::make_pair(train_departure_date.count(), train.hash()));
-    auto &train_seat_status = (*seats_it).second;
-    auto available_seat_num = train_seat_status.available_seat_num(from_ord, dest_ord);
-    ism::Messenger tmp_msgr;
-    tmp_msgr << train.train_id_ << ' ' << from_stn << ' '
-             << date_time_t(train_departure_date_time + train.departure_time_list_[from_ord]).string()
-             << " -> " << dest_stn << ' '
-             << date_time_t(train_departure_date_time + train.arrival_time_list_[dest_ord]).string()
-             << ' ' << cost << ' ' << available_seat_num << '\n';
-    ret_vec.emplace_back(tmp_msgr.str(), time, cost, train.train_id_);
-    ++from_ptr; ++dest_ptr;
+    if(is_cost_order)
+      ism::sort(
+        ret_vec.begin(), ret_vec.end(),
+        [](const QueryResultType &A, const QueryResultType &B) {
+          if(A.cost != B.cost) return A.cost < B.cost;
+          return A.train_id < B.train_id;
+        });
+    else
+      ism::sort(
+        ret_vec.begin(), ret_vec.end(),
+        [](const QueryResultType &A, const QueryResultType &B) {
+          if(A.time != B.time) return A.time < B.time;
+          return A.train_id < B.train_id;
+        });
   }
 
-  if(is_cost_order)
-    ism::sort(
-      ret_vec.begin(), ret_vec.end(),
-      [](const QueryResultType &A, const QueryResultType &B) {
-        if(A.cost != B.cost) return A.cost < B.cost;
-        return A.train_id < B.train_id;
-      });
-  else
-    ism::sort(
-      ret_vec.begin(), ret_vec.end(),
-      [](const QueryResultType &A, const QueryResultType &B) {
-        if(A.time != B.time) return A.time < B.time;
-        return A.train_id < B.train_id;
-      });
-
   msgr_ << ret_vec.size() << '\n';
-  for(const auto& ret : ret_vec)
-    msgr_ << ret.msg;
+  auto &out = msgr_.str_ref();
+  for(const auto &ret : ret_vec) {
+    msgr_ << ret.train_id << ' ' << from_stn << ' ';
+    format_to(ret.departure_date_time, out);
+    msgr_ << " -> " << dest_stn << ' ';
+    format_to(ret.departure_date_time + ret.time, out);
+    msgr_ << ' ' << ret.cost << ' ' << ret.seat_num << '\n';
+  }
 }
 
 void TrainManager::QueryTransfer(
@@ -189,34 +239,103 @@ void TrainManager::QueryTransfer(
   auto from_hsid = from_stn.hash();
   auto dest_hsid = dest_stn.hash();
 
+  TransferPlan plan;
+  bool success = transfer_engine_ == TransferEngine::HashJoin ?
+    transfer_hash_join(from_hsid, dest_hsid, passenger_departure_date, is_cost_order, plan) :
+    transfer_merge_join(from_hsid, dest_hsid, passenger_departure_date, is_cost_order, plan);
+
+  if(!success) {
+    msgr_ << "0\n";
+    return;
+  }
+
+  auto seat_num_S = available_seat_num(
+    plan.from_train, plan.from_train_dep_date, plan.stn_ord_SS, plan.stn_ord_ST);
+  auto seat_num_T = available_seat_num(
+    plan.dest_train, plan.dest_train_dep_date, plan.stn_ord_TS, plan.stn_ord_TT);
+
+  // the station names are only kept in the train records.
+  const auto interval_stn = train_hid_train_map_.find(plan.from_train.hash()).view().second
+    .stn_list_[plan.stn_ord_ST];
+  msgr_ << plan.from_train.train_id() << ' ' << from_stn << ' '
+        << plan.date_time_SS.string() << " -> "
+        << interval_stn << ' '
+        << plan.date_time_ST.string() << ' '
+        << plan.from_train.cost(plan.stn_ord_SS, plan.stn_ord_ST) << ' '
+        << seat_num_S << '\n'
+        << plan.dest_train.train_id() << ' '
+        << interval_stn << ' '
+        << plan.date_time_TS.string() << " -> "
+        << dest_stn << ' '
+        << plan.date_time_TT.string() << ' '
+        << plan.dest_train.cost(plan.stn_ord_TS, plan.stn_ord_TT) << ' '
+        << seat_num_T << '\n';
+}
+
+bool TrainManager::plan_transfer(
+  const TrainRoute &from_train, stn_num_t stn_ord_SS, stn_num_t stn_ord_ST, date_md_t from_train_dep_date,
+  const TrainRoute &dest_train, stn_num_t stn_ord_TS, stn_num_t stn_ord_TT, TransferPlan &plan) {
+  date_time_t date_time_SS =
+    date_time_t(from_train_dep_date, from_train.start_time()) + from_train.departure_time(stn_ord_SS);
+  date_time_t date_time_ST =
+    date_time_t(from_train_dep_date, from_train.start_time()) + from_train.arrival_time(stn_ord_ST);
+
+  auto passenger_dep_T_date = date_time_ST.date_md();
+  if(time_hm_t dest_time_hm_TS = dest_train.start_time() + dest_train.departure_time(stn_ord_TS);
+    date_time_ST.time_hm() > dest_time_hm_TS)
+    passenger_dep_T_date += days(1);
+  auto dest_train_dep_date =
+    dest_train.get_train_departure_date(passenger_dep_T_date, stn_ord_TS);
+  if(dest_train.final_date() < dest_train_dep_date) return false;
+  if(dest_train.start_date() > dest_train_dep_date)
+    dest_train_dep_date = dest_train.start_date(); // do not use passenger_dep_T_date again.
+  date_time_t date_time_TS =
+    date_time_t(dest_train_dep_date, dest_train.start_time()) + dest_train.departure_time(stn_ord_TS);
+  date_time_t date_time_TT =
+    date_time_t(dest_train_dep_date, dest_train.start_time()) + dest_train.arrival_time(stn_ord_TT);
+
+  plan.from_train = from_train;
+  plan.dest_train = dest_train;
+  plan.date_time_SS = date_time_SS;
+  plan.date_time_ST = date_time_ST;
+  plan.date_time_TS = date_time_TS;
+  plan.date_time_TT = date_time_TT;
+  plan.from_train_dep_date = from_train_dep_date;
+  plan.dest_train_dep_date = dest_train_dep_date;
+  plan.stn_ord_SS = stn_ord_SS;
+  plan.stn_ord_ST = stn_ord_ST;
+  plan.stn_ord_TS = stn_ord_TS;
+  plan.stn_ord_TT = stn_ord_TT;
+  plan.interval_stn_hid = from_train.stn_hid(stn_ord_ST);
+  plan.cost = from_train.cost(stn_ord_SS, stn_ord_ST) + dest_train.cost(stn_ord_TS, stn_ord_TT);
+  plan.time = minutes(date_time_TT.count() - date_time_SS.count());
+  return true;
+}
+
+bool TrainManager::transfer_less(const TransferPlan &A, const TransferPlan &B, bool is_cost_order) {
+  if(is_cost_order) {
+    if(A.cost != B.cost) return A.cost < B.cost;
+    if(A.time != B.time) return A.time < B.time;
+  } else {
+    if(A.time != B.time) return A.time < B.time;
+    if(A.cost != B.cost) return A.cost < B.cost;
+  }
+  if(A.from_train.train_id() != B.from_train.train_id())
+    return A.from_train.train_id() < B.from_train.train_id();
+  if(A.dest_train.train_id() != B.dest_train.train_id())
+    return A.dest_train.train_id() < B.dest_train.train_id();
+  return A.interval_stn_hid < B.interval_stn_hid;
+}
+
+bool TrainManager::transfer_merge_join(
+  hash_stn_name_t from_hsid, hash_stn_name_t dest_hsid,
+  date_md_t passenger_departure_date, bool is_cost_order, TransferPlan &best) {
   // already sorted in terms of htid.
   const auto from_train_list = stn_hid_train_info_multimap_.search(from_hsid);
   const auto dest_train_list = stn_hid_train_info_multimap_.search(dest_hsid);
 
   bool success = false;
-  price_t    cost;
-  time_dur_t time;
-
-  struct ResultInfoType {
-    TrainType from_train, dest_train;
-    date_time_t date_time_SS, date_time_ST, date_time_TS, date_time_TT;
-    date_md_t from_train_dep_date, dest_train_dep_date;
-    stn_num_t stn_ord_SS, stn_ord_ST, stn_ord_TS, stn_ord_TT;
-    hash_stn_name_t interval_stn_hid;
-
-    ResultInfoType() = default;
-    /*
-    ResultInfoType(
-      const TrainType &_from_train, const TrainType &_dest_train,
-      date_time_t _date_time_SS, date_time_t _date_time_ST,
-      date_time_t _date_time_TS, date_time_t _date_time_TT,
-      const stn_name_t &_interval_stn)
-    : from_train(_from_train), dest_train(_dest_train),
-      date_time_SS(_date_time_SS), date_time_ST(_date_time_ST),
-      date_time_TS(_date_time_TS), date_time_TT(_date_time_TT),
-      interval_stn(_interval_stn) {}
-    */
-  } result_info;
+  TransferPlan plan;
 
   struct InfoType {
     train_hid_t train_hid;
@@ -231,16 +350,14 @@ void TrainManager::QueryTransfer(
   ism::vector<InfoType> dest_info_list;
 
   for(const auto &[train_hid, stn_ord] : from_train_list) {
-    const auto it = train_hid_train_map_.find(train_hid);
-    const auto &train = (*it).second;
-    for(stn_num_t i = stn_ord + 1; i < train.stn_num_; ++i)
-      from_info_list.emplace_back(train_hid, stn_ord, i, train.stn_list_[i].hash());
+    const auto route = timetable_.find(train_hid);
+    for(stn_num_t i = stn_ord + 1; i < route.stn_num(); ++i)
+      from_info_list.emplace_back(train_hid, stn_ord, i, route.stn_hid(i));
   }
   for(const auto &[train_hid, stn_ord] : dest_train_list) {
-    const auto it = train_hid_train_map_.find(train_hid);
-    const auto &train = (*it).second;
+    const auto route = timetable_.find(train_hid);
     for(stn_num_t i = 0; i < stn_ord; ++i)
-      dest_info_list.emplace_back(train_hid, stn_ord, i, train.stn_list_[i].hash());
+      dest_info_list.emplace_back(train_hid, stn_ord, i, route.stn_hid(i));
   }
 
   ism::sort(from_info_list.begin(), from_info_list.end(),
@@ -263,14 +380,14 @@ void TrainManager::QueryTransfer(
     while(dest_r + 1 < dest_info_list.size() &&
           dest_info_list[dest_r + 1].interval_stn_hid == interval_stn_hid) ++dest_r;
 
-    ism::vector<TrainType> train_list_S;
-    ism::vector<TrainType> train_list_T;
+    ism::vector<TrainRoute> train_list_S;
+    ism::vector<TrainRoute> train_list_T;
     train_list_S.reserve(from_r - from_l + 1);
     train_list_T.reserve(dest_r - dest_l + 1);
     for(size_t i = from_l; i <= from_r; ++i)
-      train_list_S.push_back(train_hid_train_map_.find(from_info_list[i].train_hid).view().second);
+      train_list_S.push_back(timetable_.find(from_info_list[i].train_hid));
     for(size_t j = dest_l; j <= dest_r; ++j)
-      train_list_T.push_back(train_hid_train_map_.find(dest_info_list[j].train_hid).view().second);
+      train_list_T.push_back(timetable_.find(dest_info_list[j].train_hid));
 
     for(size_t i = from_l; i <= from_r; ++i)
       for(size_t j = dest_l; j <= dest_r; ++j) {
@@ -284,92 +401,151 @@ void TrainManager::QueryTransfer(
         auto from_train_dep_date =
           from_train.get_train_departure_date(passenger_departure_date, stn_ord_SS);
         if(!from_train.check_train_departure_date(from_train_dep_date)) continue;
-        date_time_t date_time_SS =
-          date_time_t(from_train_dep_date, from_train.start_time_) + from_train.departure_time_list_[stn_ord_SS];
-        date_time_t date_time_ST =
-          date_time_t(from_train_dep_date, from_train.start_time_) + from_train.arrival_time_list_[stn_ord_ST];
-
-        auto passenger_dep_T_date = date_time_ST.date_md();
-        if(time_hm_t dest_time_hm_TS = dest_train.start_time_ + dest_train.departure_time_list_[stn_ord_TS];
-          date_time_ST.time_hm() > dest_time_hm_TS)
-          passenger_dep_T_date += days(1);
-        auto dest_train_dep_date =
-          dest_train.get_train_departure_date(passenger_dep_T_date, stn_ord_TS);
-        if(dest_train.final_date_ < dest_train_dep_date) continue;
-        if(dest_train.start_date_ > dest_train_dep_date)
-          dest_train_dep_date = dest_train.start_date_; // do not use passenger_dep_T_date again.
-        date_time_t date_time_TS =
-          date_time_t(dest_train_dep_date, dest_train.start_time_) + dest_train.departure_time_list_[stn_ord_TS];
-        date_time_t date_time_TT =
-          date_time_t(dest_train_dep_date, dest_train.start_time_) + dest_train.arrival_time_list_[stn_ord_TT];
-
-        auto cost_here = from_train.cost(stn_ord_SS, stn_ord_ST) + dest_train.cost(stn_ord_TS, stn_ord_TT);
-        auto time_here = minutes(date_time_TT.count() - date_time_SS.count());
-
-        if(!success || (is_cost_order && [&] {
-            if(cost_here != cost) return cost_here < cost;
-            if(time_here != time) return time_here < time;
-            if(from_train.train_id_ != result_info.from_train.train_id_)
-              return from_train.train_id_ < result_info.from_train.train_id_;
-            return dest_train.train_id_ < result_info.dest_train.train_id_;
-          } ()) || (!is_cost_order && [&] {
-          if(time_here != time) return time_here < time;
-          if(cost_here != cost) return cost_here < cost;
-          if(from_train.train_id_ != result_info.from_train.train_id_)
-            return from_train.train_id_ < result_info.from_train.train_id_;
-          return dest_train.train_id_ < result_info.dest_train.train_id_;
-          } ())) {
-
+        if(!plan_transfer(from_train, stn_ord_SS, stn_ord_ST, from_train_dep_date,
+                          dest_train, stn_ord_TS, stn_ord_TT, plan))
+          continue;
+        if(!success || transfer_less(plan, best, is_cost_order)) {
           success = true;
-          cost = cost_here;
-          time = time_here;
-          result_info.from_train = from_train;
-          result_info.dest_train = dest_train;
-          result_info.date_time_SS = date_time_SS;
-          result_info.date_time_ST = date_time_ST;
-          result_info.date_time_TS = date_time_TS;
-          result_info.date_time_TT = date_time_TT;
-          result_info.from_train_dep_date = from_train_dep_date;
-          result_info.dest_train_dep_date = dest_train_dep_date;
-          result_info.interval_stn_hid = interval_stn_hid;
-          result_info.stn_ord_SS = stn_ord_SS;
-          result_info.stn_ord_ST = stn_ord_ST;
-          result_info.stn_ord_TS = stn_ord_TS;
-          result_info.stn_ord_TT = stn_ord_TT;
+          best = plan;
         }
       }
     ++from_l; ++dest_l;
   }
+  return success;
+}
 
-  if(!success) {
-    msgr_ << "0\n";
-    return;
-  }
+bool TrainManager::transfer_hash_join(
+  hash_stn_name_t from_hsid, hash_stn_name_t dest_hsid,
+  date_md_t passenger_departure_date, bool is_cost_order, TransferPlan &best) {
+  // a leg of a plan: S from the departure station to the interval station, or T from there
+  // to the destination. key is what the leg adds to the order: its cost, or its riding time.
+  struct Leg {
+    TrainRoute route;
+    stn_num_t from_ord, dest_ord;
+    date_md_t train_dep_date; // the run of S the passenger takes; unused for T.
+    int key;
+  };
+  auto leg_key = [is_cost_order](const TrainRoute &route, stn_num_t from_ord, stn_num_t dest_ord) {
+    return is_cost_order ? route.cost(from_ord, dest_ord) : route.time(from_ord, dest_ord).count();
+  };
 
-  const auto seat_num_list_S_it =
-    train_hid_seats_map_.find(
-      ism::make_pair(result_info.from_train_dep_date.count(), result_info.from_train.hash()));
-  auto seat_num_S = (*seat_num_list_S_it).second.available_seat_num(
-    result_info.stn_ord_SS, result_info.stn_ord_ST);
-  const auto seat_num_list_T_it =
-  train_hid_seats_map_.find(
-    ism::make_pair(result_info.dest_train_dep_date.count(), result_info.dest_train.hash()));
-  auto seat_num_T = (*seat_num_list_T_it).second.available_seat_num(
-    result_info.stn_ord_TS, result_info.stn_ord_TT);
-
-  msgr_ << result_info.from_train.train_id_ << ' ' << from_stn << ' '
-        << result_info.date_time_SS.string() << " -> "
-        << result_info.from_train.stn_list_[result_info.stn_ord_ST] << ' '
-        << result_info.date_time_ST.string() << ' '
-        << result_info.from_train.cost(result_info.stn_ord_SS, result_info.stn_ord_ST) << ' '
-        << seat_num_S << '\n'
-        << result_info.dest_train.train_id_ << ' '
-        << result_info.dest_train.stn_list_[result_info.stn_ord_TS] << ' '
-        << result_info.date_time_TS.string() << " -> "
-        << dest_stn << ' '
-        << result_info.date_time_TT.string() << ' '
-        << result_info.dest_train.cost(result_info.stn_ord_TS, result_info.stn_ord_TT) << ' '
-        << seat_num_T << '\n';
+  // build: the second legs, grouped by the hash of their boarding station.
+  ism::unordered_map<hash_stn_name_t, size_t> group_map;
+  ism::vector<Leg> first_legs, second_legs;
+  ism::vector<size_t> first_group, second_group;
+  size_t group_cnt = 0;
+  stn_hid_train_info_multimap_.for_each_equal(dest_hsid, [&](const ism::pair<train_hid_t, stn_num_t> &info) {
+    const auto &[train_hid, stn_ord_TT] = info;
+    const auto route = timetable_.find(train_hid);
+    for(stn_num_t j = 0; j < stn_ord_TT; ++j) {
+      auto hsid = route.stn_hid(j);
+      auto it = group_map.find(hsid);
+      if(it == group_map.end())
+        it = group_map.insert({hsid, group_cnt++});
+      second_group.push_back(it->second);
+      second_legs.push_back(Leg{route, j, stn_ord_TT, date_md_t(), leg_key(route, j, stn_ord_TT)});
+    }
+  });
+  if(group_cnt == 0)
+    return false;
+  // probe: the first legs of the runs that fit the date, kept if they reach a group.
+  stn_hid_train_info_multimap_.for_each_equal(from_hsid, [&](const ism::pair<train_hid_t, stn_num_t> &info) {
+    const auto &[train_hid, stn_ord_SS] = info;
+    const auto route = timetable_.find(train_hid);
+    auto train_dep_date = route.get_train_departure_date(passenger_departure_date, stn_ord_SS);
+    if(!route.check_train_departure_date(train_dep_date))
+      return;
+    for(stn_num_t i = stn_ord_SS + 1; i < route.stn_num(); ++i) {
+      auto it = group_map.find(route.stn_hid(i));
+      if(it == group_map.end())
+        continue;
+      first_group.push_back(it->second);
+      first_legs.push_back(Leg{route, stn_ord_SS, i, train_dep_date, leg_key(route, stn_ord_SS, i)});
+    }
+  });
+  if(first_legs.empty())
+    return false;
+
+  // lays legs out group by group, each group in key order. beg[g] is where group g starts.
+  auto arrange = [group_cnt](const ism::vector<Leg> &legs, const ism::vector<size_t> &group,
+                             ism::vector<Leg> &arranged, ism::vector<size_t> &beg) {
+    beg.resize(group_cnt + 1, 0);
+    for(auto g : group)
+      ++beg[g + 1];
+    for(size_t g = 0; g < group_cnt; ++g)
+      beg[g + 1] += beg[g];
+    ism::vector<size_t> fill(beg);
+    arranged.resize(legs.size());
+    for(size_t k = 0; k < legs.size(); ++k)
+      arranged[fill[group[k]]++] = legs[k];
+    for(size_t g = 0; g < group_cnt; ++g)
+      ism::sort(arranged.begin() + beg[g], arranged.begin() + beg[g + 1],
+        [](const Leg &A, const Leg &B) { return A.key < B.key; });
+  };
+  ism::vector<Leg> S_legs, T_legs;
+  ism::vector<size_t> S_beg, T_beg;
+  arrange(first_legs, first_group, S_legs, S_beg);
+  arrange(second_legs, second_group, T_legs, T_beg);
+
+  // a task is an interval station both sides reach.
+  ism::vector<size_t> tasks;
+  size_t pair_cnt = 0;
+  for(size_t g = 0; g < group_cnt; ++g)
+    if(S_beg[g] != S_beg[g + 1]) {
+      tasks.push_back(g);
+      pair_cnt += (S_beg[g + 1] - S_beg[g]) * (T_beg[g + 1] - T_beg[g]);
+    }
+
+  // A plan costs cost_S + cost_T and takes at least time_S + time_T (waiting is never
+  // negative). Both lists of a group are walked in key order until that bound is worse than
+  // the best plan any worker has found; each worker keeps its own best plan.
+  struct WorkerBest {
+    TransferPlan plan;
+    bool success = false;
+  };
+  ism::vector<WorkerBest> worker_best;
+  worker_best.resize(transfer_pool_.worker_count());
+  std::atomic<int> best_key(INT_MAX);
+  auto search = [&](size_t worker, size_t task) {
+    auto g = tasks[task];
+    auto &local = worker_best[worker];
+    TransferPlan plan;
+    for(size_t a = S_beg[g]; a < S_beg[g + 1]; ++a) {
+      const auto &S = S_legs[a];
+      if(S.key + T_legs[T_beg[g]].key > best_key.load(std::memory_order_relaxed))
+        break;
+      for(size_t b = T_beg[g]; b < T_beg[g + 1]; ++b) {
+        const auto &T = T_legs[b];
+        if(S.key + T.key > best_key.load(std::memory_order_relaxed))
+          break;
+        if(S.route.hash() == T.route.hash())
+          continue;
+        if(!plan_transfer(S.route, S.from_ord, S.dest_ord, S.train_dep_date,
+                          T.route, T.from_ord, T.dest_ord, plan))
+          continue;
+        if(local.success && !transfer_less(plan, local.plan, is_cost_order))
+          continue;
+        local.success = true;
+        local.plan = plan;
+        int key = is_cost_order ? plan.cost : plan.time.count();
+        int cur = best_key.load(std::memory_order_relaxed);
+        while(key < cur && !best_key.compare_exchange_weak(cur, key, std::memory_order_relaxed)) {}
+      }
+    }
+  };
+  if(pair_cnt < PARALLEL_TRANSFER_PAIRS)
+    for(size_t task = 0; task < tasks.size(); ++task)
+      search(0, task);
+  else
+    transfer_pool_.run(tasks.size(), search);
+
+  bool success = false;
+  for(const auto &local : worker_best)
+    if(local.success && (!success || transfer_less(local.plan, best, is_cost_order))) {
+      success = true;
+      best = local.plan;
+    }
+  return success;
 }
 
 TicketOrderType TrainManager::BuyTicket(
@@ -379,25 +555,23 @@ TicketOrderType TrainManager::BuyTicket(
   date_md_t passenger_departure_date, seat_num_t ticket_num,
   bool accept_waitlist) {
 
-  auto thid = train_id.hash();
-  const auto train_it = train_hid_train_map_.find(thid);
-  const auto &train = (*train_it).second;
-
-  if(ticket_num > train.max_seat_num_) {
+  // only released trains are in the timetable.
+  const auto train = timetable_.find(train_id.hash());
+  if(!train.is_valid() || ticket_num > train.max_seat_num()) {
     msgr_ << "-1\n";
     return {};
   }
 
-  stn_num_t from_ord = train.stn_num_ + 1;
-  stn_num_t dest_ord = train.stn_num_ + 1;
+  stn_num_t from_ord = train.stn_num() + 1;
+  stn_num_t dest_ord = train.stn_num() + 1;
   auto from_stn_hash = from_stn.hash();
   auto dest_stn_hash = dest_stn.hash();
-  for(stn_num_t i = 0; i < train.stn_num_; ++i) {
-    auto stn_hash = train.stn_list_[i].hash();
+  for(stn_num_t i = 0; i < train.stn_num(); ++i) {
+    auto stn_hash = train.stn_hid(i);
     if(stn_hash == from_stn_hash) from_ord = i;
     if(stn_hash == dest_stn_hash) dest_ord = i;
   }
-  if(from_ord == train.stn_num_ + 1 || dest_ord == train.stn_num_ + 1 || from_ord >= dest_ord) {
+  if(from_ord == train.stn_num() + 1 || dest_ord == train.stn_num() + 1 || from_ord >= dest_ord) {
     msgr_ << "-1\n";
     return {};
   }
@@ -406,37 +580,90 @@ TicketOrderType TrainManager::BuyTicket(
     msgr_ << "-1\n";
     return {};
   }
-  auto seat_it = train_hid_seats_map_.find(ism::make_pair(train_departure_date.count(), thid));
-  auto available_seats = seat_it.view().second.available_seat_num(from_ord, dest_ord);
+  auto available_seats = available_seat_num(train, train_departure_date, from_ord, dest_ord);
   if(available_seats < ticket_num) {
     if(accept_waitlist) {
       msgr_ << "queue\n";
       return {
         TicketOrderType::OrderStatus::Pending, username, train_id, from_stn, dest_stn,
-        date_time_t(train_departure_date, train.start_time_) + train.departure_time_list_[from_ord],
-        date_time_t(train_departure_date, train.start_time_) + train.arrival_time_list_[dest_ord],
+        date_time_t(train_departure_date, train.start_time()) + train.departure_time(from_ord),
+        date_time_t(train_departure_date, train.start_time()) + train.arrival_time(dest_ord),
         from_ord, dest_ord, train.cost(from_ord, dest_ord), ticket_num, train_departure_date};
     }
     msgr_ << "-1\n";
     return {};
   }
-  (*seat_it).second.consume_seat_num(ticket_num, from_ord, dest_ord);
+  auto seat_visitor = seat_status_visitor(train, train_departure_date);
+  auto seat_status = seat_visitor.as_mut();
+  if(seat_status->is_unsold())
+    seat_status->initialize(train.max_seat_num(), train.stn_num());
+  seat_status->consume_seat_num(ticket_num, from_ord, dest_ord);
   msgr_ << train.cost(from_ord, dest_ord) * ticket_num << '\n';
   return {
     TicketOrderType::OrderStatus::Success, username, train_id, from_stn, dest_stn,
-    date_time_t(train_departure_date, train.start_time_) + train.departure_time_list_[from_ord],
-    date_time_t(train_departure_date, train.start_time_) + train.arrival_time_list_[dest_ord],
+    date_time_t(train_departure_date, train.start_time()) + train.departure_time(from_ord),
+    date_time_t(train_departure_date, train.start_time()) + train.arrival_time(dest_ord),
     from_ord, dest_ord, train.cost(from_ord, dest_ord), ticket_num, train_departure_date};
 }
 
-ism::Bplustree<ism::pair<days_count_t, train_hid_t>, TrainSeatStatus>::iterator
-TrainManager::get_seat_status_iter(const train_id_t &train_id, date_md_t train_dep_date) {
-  return train_hid_seats_map_.find(ism::make_pair(train_dep_date.count(), train_id.hash()));
+ism::CompressedBufferPool<TrainSeatStatus>::Visitor
+TrainManager::get_seat_status_visitor(const train_id_t &train_id, date_md_t train_dep_date) {
+  const auto train = timetable_.find(train_id.hash());
+  auto visitor = seat_status_visitor(train, train_dep_date);
+  if(visitor.as()->is_unsold())
+    visitor.as_mut()->initialize(train.max_seat_num(), train.stn_num());
+  return visitor;
+}
+
+StnPairTrainInfo TrainManager::stn_pair_info(const TrainRoute &route, stn_num_t from_ord, stn_num_t dest_ord) {
+  StnPairTrainInfo info;
+  info.train_hid_ = route.hash();
+  info.train_id_ = route.train_id();
+  info.from_ord_ = from_ord;
+  info.dest_ord_ = dest_ord;
+  info.cost_ = route.cost(from_ord, dest_ord);
+  info.time_ = route.time(from_ord, dest_ord);
+  info.departure_time_ = route.departure_time(from_ord);
+  info.start_time_ = route.start_time();
+  info.start_date_ = route.start_date();
+  info.final_date_ = route.final_date();
+  info.max_seat_num_ = route.max_seat_num();
+  info.seat_base_ = route.seat_base();
+  return info;
+}
+
+void TrainManager::index_stn_pairs(const TrainType &train) {
+  for(stn_num_t i = 0; i < train.stn_num_; ++i)
+    for(stn_num_t j = i + 1; j < train.stn_num_; ++j) {
+      auto stn_pair = ism::make_pair(train.stn_list_[i].hash(), train.stn_list_[j].hash());
+      StnPairTrainInfo info(train, i, j);
+      stn_pair_time_multimap_.insert(stn_pair, info);
+      stn_pair_cost_multimap_.insert(stn_pair, info);
+    }
+  stn_pair_train_cnt_.alloc();
 }
 
 void TrainManager::clean() {
   train_hid_train_map_.clear();
-  train_hid_seats_map_.clear();
+  seat_calendar_.clear();
   stn_hid_train_info_multimap_.clear();
+  stn_pair_time_multimap_.clear();
+  stn_pair_cost_multimap_.clear();
+  stn_pair_train_cnt_.clear();
+  timetable_.clear();
+}
+
+void TrainManager::report_index_stats(std::ostream &os) {
+  os << "[train -> train index]\n" << train_hid_train_map_.stats();
+  os << "[station -> trains]\n" << stn_hid_train_info_multimap_.stats();
+  os << "[station pair -> trains by time]\n" << stn_pair_time_multimap_.stats();
+  os << "[station pair -> trains by cost]\n" << stn_pair_cost_multimap_.stats();
+}
+
+void TrainManager::compact_step(size_t budget) {
+  train_hid_train_map_.compact_step(budget);
+  stn_hid_train_info_multimap_.compact_step(budget);
+  stn_pair_time_multimap_.compact_step(budget);
+  stn_pair_cost_multimap_.compact_step(budget);
 }
 }
\ No newline at end of file
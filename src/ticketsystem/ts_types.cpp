@@ -190,4 +190,82 @@ void CmdRefundTicket::handle(char par_name, const char *beg, size_t n) {
   }
 }
 
-}
\ No newline at end of file
+void TrainSeatStatus::initialize(seat_num_t seat_num, stn_num_t stn_num) {
+  stn_num_ = stn_num;
+  is_tree_ = (seat_num <= TREE_SEAT_LIM);
+  if(!is_tree_) {
+    for(size_t j = 0; j < stn_num - 1; ++j)
+      flat_[j] = seat_num;
+    return;
+  }
+  // all segments equal: every offset is 0.
+  tree_.root_min = seat_num;
+  for(size_t v = 1; v < 2 * (stn_num - 1) - 1; ++v)
+    rel(v) = 0;
+}
+
+seat_num_t TrainSeatStatus::available_seat_num(stn_num_t from_ord, stn_num_t dest_ord) const {
+  if(!is_tree_)
+    return ism::range_min(flat_ + from_ord, dest_ord - from_ord);
+  return tree_min(0, 0, stn_num_ - 1, from_ord, dest_ord, tree_.root_min);
+}
+
+void TrainSeatStatus::add_seat_num(seat_num_t delta, stn_num_t from_ord, stn_num_t dest_ord) {
+  if(!is_tree_) {
+    ism::range_add(flat_ + from_ord, dest_ord - from_ord, delta);
+    return;
+  }
+  tree_.root_min = tree_add(0, 0, stn_num_ - 1, from_ord, dest_ord, delta, tree_.root_min);
+}
+
+void TrainSeatStatus::get_seat_num_list(seat_num_list_t &seat_num_list) const {
+  if(!is_tree_) {
+    for(stn_num_t i = 0; i < stn_num_ - 1; ++i)
+      seat_num_list[i] = flat_[i];
+    return;
+  }
+  tree_walk(0, 0, stn_num_ - 1, tree_.root_min, seat_num_list);
+}
+
+int TrainSeatStatus::tree_add(size_t v, int lo, int hi, int from_ord, int dest_ord, int delta, int rel_v) {
+  if(from_ord <= lo && hi <= dest_ord)
+    return rel_v + delta;
+  int mid = (lo + hi) / 2;
+  size_t lft = v + 1, rht = v + 2 * (mid - lo);
+  int lft_rel = rel(lft), rht_rel = rel(rht);
+  if(from_ord < mid)
+    lft_rel = tree_add(lft, lo, mid, from_ord, dest_ord, delta, lft_rel);
+  if(mid < dest_ord)
+    rht_rel = tree_add(rht, mid, hi, from_ord, dest_ord, delta, rht_rel);
+  // the children stay within [0, seat_num] of the new minimum.
+  int min_rel = std::min(lft_rel, rht_rel);
+  rel(lft) = lft_rel - min_rel;
+  rel(rht) = rht_rel - min_rel;
+  return rel_v + min_rel;
+}
+
+int TrainSeatStatus::tree_min(size_t v, int lo, int hi, int from_ord, int dest_ord, int base) const {
+  if(from_ord <= lo && hi <= dest_ord)
+    return base;
+  int mid = (lo + hi) / 2;
+  size_t lft = v + 1, rht = v + 2 * (mid - lo);
+  if(dest_ord <= mid)
+    return tree_min(lft, lo, mid, from_ord, dest_ord, base + rel(lft));
+  if(mid <= from_ord)
+    return tree_min(rht, mid, hi, from_ord, dest_ord, base + rel(rht));
+  return std::min(tree_min(lft, lo, mid, from_ord, dest_ord, base + rel(lft)),
+                  tree_min(rht, mid, hi, from_ord, dest_ord, base + rel(rht)));
+}
+
+void TrainSeatStatus::tree_walk(size_t v, int lo, int hi, int base, seat_num_list_t &seat_num_list) const {
+  if(lo + 1 == hi) {
+    seat_num_list[lo] = base;
+    return;
+  }
+  int mid = (lo + hi) / 2;
+  size_t lft = v + 1, rht = v + 2 * (mid - lo);
+  tree_walk(lft, lo, mid, base + rel(lft), seat_num_list);
+  tree_walk(rht, mid, hi, base + rel(rht), seat_num_list);
+}
+
+}
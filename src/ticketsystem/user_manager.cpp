@@ -3,9 +3,11 @@
 namespace ticket_system {
 
 static constexpr int BUF_CAPA = 150, K_DIST = 2;
+// Bloom filter bits per user id, so that adding a new user mostly skips the bucket read.
+static constexpr size_t FILTER_BITS = 10;
 
 UserManager::UserManager(std::filesystem::path path, ism::Messenger &msgr)
-: user_hid_user_map_(path.string() + "-huid", BUF_CAPA, K_DIST), msgr_(msgr) {}
+: user_hid_user_map_(path.string() + "-huid", BUF_CAPA, K_DIST, FILTER_BITS), msgr_(msgr) {}
 
 void UserManager::AddUser(const username_t &cur_username, UserType &tar_user) {
   if(user_hid_user_map_.empty()) {
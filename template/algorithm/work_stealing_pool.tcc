@@ -0,0 +1,18 @@
+#ifndef INSOMNIA_WORK_STEALING_POOL_TCC
+#define INSOMNIA_WORK_STEALING_POOL_TCC
+
+#include "work_stealing_pool.h"
+
+namespace insomnia {
+
+template <class Func>
+void WorkStealingPool::run(size_t task_cnt, Func &&fn) {
+  using FuncT = std::remove_reference_t<Func>;
+  run_batch(task_cnt, [](void *ctx, size_t worker, size_t task) {
+    (*static_cast<FuncT*>(ctx))(worker, task);
+  }, const_cast<void*>(static_cast<const void*>(&fn)));
+}
+
+}
+
+#endif
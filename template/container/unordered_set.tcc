@@ -114,7 +114,7 @@ void unordered_set<T, Hash, Equal>::clear() {
     }
     _node_list[i]->b_nxt = nullptr;
   }
-  _header->t_nxt = _header->t_prv = nullptr;
+  _header->t_nxt = _header->t_prv = _header;
   _size = 0;
 }
 
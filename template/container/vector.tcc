@@ -199,6 +199,11 @@ T* vector<T>::data() {
   return _beg;
 }
 
+template <class T>
+const T* vector<T>::data() const {
+  return _beg;
+}
+
 
 
 }
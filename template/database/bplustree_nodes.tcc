@@ -5,16 +5,16 @@
 
 namespace insomnia {
 
-template <class KeyT, class ValueT>
-void MultiBptInternalNode<KeyT, ValueT>::init(int max_size) {
+template <class KeyT, class ValueT, size_t page_size>
+void MultiBptInternalNode<KeyT, ValueT, page_size>::init(int max_size) {
   node_type_ = NodeT::Internal;
   max_size_ = max_size;
   size_ = 0;
 }
 
-template <class KeyT, class ValueT>
+template <class KeyT, class ValueT, size_t page_size>
 template <class KVCompare>
-int MultiBptInternalNode<KeyT, ValueT>::locate_pair(
+int MultiBptInternalNode<KeyT, ValueT, page_size>::locate_pair(
   const KeyT &key, const ValueT &value, KVCompare kv_compare) const {
   int lft = 1, rht = size_ - 1;
   if(kv_compare(key, value, storage_[lft].key, storage_[lft].value))
@@ -29,9 +29,9 @@ int MultiBptInternalNode<KeyT, ValueT>::locate_pair(
   return rht;
 }
 
-template <class KeyT, class ValueT>
+template <class KeyT, class ValueT, size_t page_size>
 template <class KeyCompare>
-int MultiBptInternalNode<KeyT, ValueT>::locate_key(const KeyT &key, KeyCompare key_compare) const {
+int MultiBptInternalNode<KeyT, ValueT, page_size>::locate_key(const KeyT &key, KeyCompare key_compare) const {
   int lft = 1, rht = size_ - 1;
   if(!key_compare(storage_[lft].key, key))
     return lft - 1;
@@ -45,27 +45,36 @@ int MultiBptInternalNode<KeyT, ValueT>::locate_key(const KeyT &key, KeyCompare k
   return rht;
 }
 
-template <class KeyT, class ValueT>
-void MultiBptInternalNode<KeyT, ValueT>::insert(int pos, const KeyT &key, const ValueT &value, page_id_t child) {
+template <class KeyT, class ValueT, size_t page_size>
+void MultiBptInternalNode<KeyT, ValueT, page_size>::insert(
+  int pos, const KeyT &key, const ValueT &value, page_id_t child, size_t count) {
   memmove(storage_ + pos + 1, storage_ + pos, (size_ - pos) * sizeof(Storage));
-  storage_[pos] = {key, value, child};
+  storage_[pos] = {key, value, child, count};
   size_ += 1;
 }
 
-template <class KeyT, class ValueT>
-void MultiBptInternalNode<KeyT, ValueT>::remove(int pos) {
+template <class KeyT, class ValueT, size_t page_size>
+size_t MultiBptInternalNode<KeyT, ValueT, page_size>::total() const {
+  size_t total = 0;
+  for(int i = 0; i < size_; ++i)
+    total += storage_[i].count;
+  return total;
+}
+
+template <class KeyT, class ValueT, size_t page_size>
+void MultiBptInternalNode<KeyT, ValueT, page_size>::remove(int pos) {
   memmove(storage_ + pos, storage_ + pos + 1, (size_ - pos - 1) * sizeof(Storage));
   size_ -= 1;
 }
 
-template <class KeyT, class ValueT>
-void MultiBptInternalNode<KeyT, ValueT>::update(int pos, const KeyT &key, const ValueT &value) {
+template <class KeyT, class ValueT, size_t page_size>
+void MultiBptInternalNode<KeyT, ValueT, page_size>::update(int pos, const KeyT &key, const ValueT &value) {
   storage_[pos].key = key;
   storage_[pos].value = value;
 }
 
-template <class KeyT, class ValueT>
-void MultiBptInternalNode<KeyT, ValueT>::split(MultiBptInternalNode *rht) {
+template <class KeyT, class ValueT, size_t page_size>
+void MultiBptInternalNode<KeyT, ValueT, page_size>::split(MultiBptInternalNode *rht) {
   int lft_size = size_ / 2, rht_size = size_ - lft_size;
   memcpy(rht->storage_, storage_ + lft_size, rht_size * sizeof(Storage));
   size_ = lft_size;
@@ -73,8 +82,8 @@ void MultiBptInternalNode<KeyT, ValueT>::split(MultiBptInternalNode *rht) {
 }
 
 
-template <class KeyT, class ValueT>
-void MultiBptInternalNode<KeyT, ValueT>::coalesce(MultiBptInternalNode *rht) {
+template <class KeyT, class ValueT, size_t page_size>
+void MultiBptInternalNode<KeyT, ValueT, page_size>::coalesce(MultiBptInternalNode *rht) {
   int lft_old_size = size_, rht_old_size = rht->size_;
   int tot_size = lft_old_size + rht_old_size;
   memcpy(storage_ + lft_old_size, rht->storage_, rht_old_size * sizeof(Storage));
@@ -82,8 +91,8 @@ void MultiBptInternalNode<KeyT, ValueT>::coalesce(MultiBptInternalNode *rht) {
   rht->size_ = 0;
 }
 
-template <class KeyT, class ValueT>
-void MultiBptInternalNode<KeyT, ValueT>::redistribute_left(MultiBptInternalNode *lft) {
+template <class KeyT, class ValueT, size_t page_size>
+void MultiBptInternalNode<KeyT, ValueT, page_size>::redistribute_left(MultiBptInternalNode *lft) {
   int lft_old_size = lft->size_, rht_old_size = size_;
   int tot_size = lft_old_size + rht_old_size;
   int lft_new_size = tot_size / 2, rht_new_size = tot_size - lft_new_size;
@@ -94,8 +103,8 @@ void MultiBptInternalNode<KeyT, ValueT>::redistribute_left(MultiBptInternalNode
   size_ = rht_new_size;
 }
 
-template <class KeyT, class ValueT>
-void MultiBptInternalNode<KeyT, ValueT>::redistribute_right(MultiBptInternalNode *rht) {
+template <class KeyT, class ValueT, size_t page_size>
+void MultiBptInternalNode<KeyT, ValueT, page_size>::redistribute_right(MultiBptInternalNode *rht) {
   int lft_old_size = size_, rht_old_size = rht->size_;
   int tot_size = lft_old_size + rht_old_size;
   int lft_new_size = tot_size / 2, rht_new_size = tot_size - lft_new_size;
@@ -108,17 +117,17 @@ void MultiBptInternalNode<KeyT, ValueT>::redistribute_right(MultiBptInternalNode
 
 /**********************************************************************************************************************/
 
-template <class KeyT, class ValueT>
-void BptLeafNode<KeyT, ValueT>::init(int max_size) {
+template <class KeyT, class ValueT, size_t page_size>
+void BptLeafNode<KeyT, ValueT, page_size>::init(int max_size) {
   node_type_ = NodeT::Leaf;
   max_size_ = max_size;
   size_ = 0;
   rht_ptr_ = NULL_PAGE_ID;
 }
 
-template <class KeyT, class ValueT>
+template <class KeyT, class ValueT, size_t page_size>
 template <class KVCompare>
-int BptLeafNode<KeyT, ValueT>::locate_pair(
+int BptLeafNode<KeyT, ValueT, page_size>::locate_pair(
   const KeyT &key, const ValueT &value, KVCompare kv_compare) const {
   int lft = 0, rht = size_ - 1;
   if(kv_compare(storage_[rht].key, storage_[rht].value, key, value))
@@ -133,9 +142,9 @@ int BptLeafNode<KeyT, ValueT>::locate_pair(
   return rht;
 }
 
-template <class KeyT, class ValueT>
+template <class KeyT, class ValueT, size_t page_size>
 template <class KeyCompare>
-int BptLeafNode<KeyT, ValueT>::locate_key(const KeyT &key, KeyCompare key_compare) const {
+int BptLeafNode<KeyT, ValueT, page_size>::locate_key(const KeyT &key, KeyCompare key_compare) const {
   int lft = 0, rht = size_ - 1;
   if(key_compare(storage_[rht].key, key))
     return rht + 1;
@@ -149,21 +158,27 @@ int BptLeafNode<KeyT, ValueT>::locate_key(const KeyT &key, KeyCompare key_compar
   return rht;
 }
 
-template <class KeyT, class ValueT>
-void BptLeafNode<KeyT, ValueT>::insert(int pos, const KeyT &key, const ValueT &value) {
+template <class KeyT, class ValueT, size_t page_size>
+void BptLeafNode<KeyT, ValueT, page_size>::insert(int pos, const KeyT &key, const ValueT &value) {
   memmove(storage_ + pos + 1, storage_ + pos, (size_ - pos) * sizeof(Storage));
   storage_[pos] = {key, value};
   size_ += 1;
 }
 
-template <class KeyT, class ValueT>
-void BptLeafNode<KeyT, ValueT>::remove(int pos) {
+template <class KeyT, class ValueT, size_t page_size>
+void BptLeafNode<KeyT, ValueT, page_size>::remove(int pos) {
   memmove(storage_ + pos, storage_ + pos + 1, (size_ - pos - 1) * sizeof(Storage));
   size_ -= 1;
 }
 
-template <class KeyT, class ValueT>
-void BptLeafNode<KeyT, ValueT>::split(BptLeafNode *rht, page_id_t rht_ptr) {
+template <class KeyT, class ValueT, size_t page_size>
+void BptLeafNode<KeyT, ValueT, page_size>::remove(int first, int last) {
+  memmove(storage_ + first, storage_ + last, (size_ - last) * sizeof(Storage));
+  size_ -= last - first;
+}
+
+template <class KeyT, class ValueT, size_t page_size>
+void BptLeafNode<KeyT, ValueT, page_size>::split(BptLeafNode *rht, page_id_t rht_ptr) {
   int lft_size = size_ / 2, rht_size = size_ - lft_size;
   memcpy(rht->storage_, storage_ + lft_size, rht_size * sizeof(Storage));
   size_ = lft_size;
@@ -172,8 +187,8 @@ void BptLeafNode<KeyT, ValueT>::split(BptLeafNode *rht, page_id_t rht_ptr) {
   rht_ptr_ = rht_ptr;
 }
 
-template <class KeyT, class ValueT>
-void BptLeafNode<KeyT, ValueT>::coalesce(BptLeafNode *rht) {
+template <class KeyT, class ValueT, size_t page_size>
+void BptLeafNode<KeyT, ValueT, page_size>::coalesce(BptLeafNode *rht) {
   int lft_old_size = size_, rht_old_size = rht->size_;
   int tot_size = lft_old_size + rht_old_size;
   memcpy(storage_ + lft_old_size, rht->storage_, rht_old_size * sizeof(Storage));
@@ -183,8 +198,8 @@ void BptLeafNode<KeyT, ValueT>::coalesce(BptLeafNode *rht) {
   rht->rht_ptr_ = NULL_PAGE_ID;
 }
 
-template <class KeyT, class ValueT>
-void BptLeafNode<KeyT, ValueT>::redistribute_left(BptLeafNode *lft) {
+template <class KeyT, class ValueT, size_t page_size>
+void BptLeafNode<KeyT, ValueT, page_size>::redistribute_left(BptLeafNode *lft) {
   int lft_old_size = lft->size_, rht_old_size = size_;
   int tot_size = lft_old_size + rht_old_size;
   int lft_new_size = tot_size / 2, rht_new_size = tot_size - lft_new_size;
@@ -195,8 +210,8 @@ void BptLeafNode<KeyT, ValueT>::redistribute_left(BptLeafNode *lft) {
   size_ = rht_new_size;
 }
 
-template <class KeyT, class ValueT>
-void BptLeafNode<KeyT, ValueT>::redistribute_right(BptLeafNode *rht) {
+template <class KeyT, class ValueT, size_t page_size>
+void BptLeafNode<KeyT, ValueT, page_size>::redistribute_right(BptLeafNode *rht) {
   int lft_old_size = size_, rht_old_size = rht->size_;
   int tot_size = lft_old_size + rht_old_size;
   int lft_new_size = tot_size / 2, rht_new_size = tot_size - lft_new_size;
@@ -209,16 +224,264 @@ void BptLeafNode<KeyT, ValueT>::redistribute_right(BptLeafNode *rht) {
 
 /**********************************************************************************************************************/
 
-template <class KeyT>
-void BptInternalNode<KeyT>::init(int max_size) {
+template <class KeyT, class ValueT, size_t page_size> requires KeyEncodable<KeyT>
+void BptPrefixLeafNode<KeyT, ValueT, page_size>::init() {
+  static_assert(sizeof(BptPrefixLeafNode) <= NODE_SIZE);
+  node_type_ = NodeT::Leaf;
+  size_ = 0;
+  rht_ptr_ = NULL_PAGE_ID;
+  prefix_len_ = 0;
+  has_lo_ = has_hi_ = false;
+  max_size_ = capacity_of(0) - 1;
+}
+
+template <class KeyT, class ValueT, size_t page_size> requires KeyEncodable<KeyT>
+template <class KVCompare>
+int BptPrefixLeafNode<KeyT, ValueT, page_size>::locate_pair(
+  const KeyT &key, const ValueT &value, KVCompare kv_compare) const {
+  if(size_ == 0) return 0;
+  int lft = 0, rht = size_ - 1;
+  if(kv_compare(this->key(rht), values()[rht], key, value))
+    return rht + 1;
+  while(lft < rht) {
+    int mid = (lft + rht) / 2;
+    if(kv_compare(this->key(mid), values()[mid], key, value))
+      lft = mid + 1;
+    else
+      rht = mid;
+  }
+  return rht;
+}
+
+template <class KeyT, class ValueT, size_t page_size> requires KeyEncodable<KeyT>
+template <class KeyCompare>
+int BptPrefixLeafNode<KeyT, ValueT, page_size>::locate_key(const KeyT &key, KeyCompare key_compare) const {
+  if(size_ == 0) return 0;
+  int lft = 0, rht = size_ - 1;
+  if(key_compare(this->key(rht), key))
+    return rht + 1;
+  while(lft < rht) {
+    int mid = (lft + rht) / 2;
+    if(key_compare(this->key(mid), key))
+      lft = mid + 1;
+    else
+      rht = mid;
+  }
+  return rht;
+}
+
+template <class KeyT, class ValueT, size_t page_size> requires KeyEncodable<KeyT>
+void BptPrefixLeafNode<KeyT, ValueT, page_size>::insert(int pos, const KeyT &key, const ValueT &value) {
+  unsigned char bytes[KEY_SIZE];
+  Codec::encode(key, bytes);
+  if(memcmp(bytes, lo_, prefix_len_) != 0) {
+    // the fences are keys only, while a multi tree routes by (key, value) separators.
+    unsigned char old_prefix[KEY_SIZE];
+    int old_prefix_len = prefix_len_;
+    memcpy(old_prefix, lo_, old_prefix_len);
+    memcpy(memcmp(bytes, lo_, KEY_SIZE) < 0 ? lo_ : hi_, bytes, KEY_SIZE);
+    relayout(old_prefix, old_prefix_len);
+  }
+  if(size_ >= capacity_of(prefix_len_))
+    throw debug_exception("prefix leaf overflow");
+  memmove(values() + pos + 1, values() + pos, (size_ - pos) * sizeof(ValueT));
+  memmove(suffix(pos + 1), suffix(pos), (size_ - pos) * suffix_len());
+  assign(pos, bytes, value);
+  size_ += 1;
+}
+
+template <class KeyT, class ValueT, size_t page_size> requires KeyEncodable<KeyT>
+bool BptPrefixLeafNode<KeyT, ValueT, page_size>::fits(const KeyT &key) const {
+  unsigned char bytes[KEY_SIZE];
+  Codec::encode(key, bytes);
+  if(memcmp(bytes, lo_, prefix_len_) == 0)
+    return true;
+  int prefix_len = common_prefix(bytes, memcmp(bytes, lo_, KEY_SIZE) < 0 ? hi_ : lo_);
+  return size_ < capacity_of(prefix_len);
+}
+
+template <class KeyT, class ValueT, size_t page_size> requires KeyEncodable<KeyT>
+void BptPrefixLeafNode<KeyT, ValueT, page_size>::remove(int pos) {
+  memmove(values() + pos, values() + pos + 1, (size_ - pos - 1) * sizeof(ValueT));
+  memmove(suffix(pos), suffix(pos + 1), (size_ - pos - 1) * suffix_len());
+  size_ -= 1;
+}
+
+template <class KeyT, class ValueT, size_t page_size> requires KeyEncodable<KeyT>
+void BptPrefixLeafNode<KeyT, ValueT, page_size>::remove(int first, int last) {
+  memmove(values() + first, values() + last, (size_ - last) * sizeof(ValueT));
+  memmove(suffix(first), suffix(last), (size_ - last) * suffix_len());
+  size_ -= last - first;
+}
+
+template <class KeyT, class ValueT, size_t page_size> requires KeyEncodable<KeyT>
+void BptPrefixLeafNode<KeyT, ValueT, page_size>::set_hi_fence(const KeyT &hi) {
+  unsigned char old_prefix[KEY_SIZE];
+  int old_prefix_len = prefix_len_;
+  memcpy(old_prefix, lo_, old_prefix_len);
+  has_hi_ = true;
+  Codec::encode(hi, hi_);
+  relayout(old_prefix, old_prefix_len);
+}
+
+template <class KeyT, class ValueT, size_t page_size> requires KeyEncodable<KeyT>
+void BptPrefixLeafNode<KeyT, ValueT, page_size>::relayout(const unsigned char *old_prefix, int old_prefix_len) {
+  int new_prefix_len = fence_prefix_len();
+  if(capacity_of(new_prefix_len) < size_)
+    throw debug_exception("prefix leaf overflow");
+  int old_suffix_len = KEY_SIZE - old_prefix_len;
+  unsigned char old_suffixes[DATA_SIZE];
+  memcpy(old_suffixes, data_ + capacity_of(old_prefix_len) * sizeof(ValueT), size_ * old_suffix_len);
+  prefix_len_ = new_prefix_len;
+  max_size_ = capacity_of(new_prefix_len) - 1;
+  unsigned char bytes[KEY_SIZE];
+  memcpy(bytes, old_prefix, old_prefix_len);
+  for(int i = 0; i < size_; ++i) {
+    memcpy(bytes + old_prefix_len, old_suffixes + i * old_suffix_len, old_suffix_len);
+    memcpy(suffix(i), bytes + prefix_len_, suffix_len());
+  }
+}
+
+template <class KeyT, class ValueT, size_t page_size> requires KeyEncodable<KeyT>
+void BptPrefixLeafNode<KeyT, ValueT, page_size>::split(BptPrefixLeafNode *rht, page_id_t rht_ptr) {
+  int lft_size = size_ / 2, rht_size = size_ - lft_size;
+  unsigned char sep[KEY_SIZE], bytes[KEY_SIZE];
+  full_key(lft_size, sep);
+
+  rht->has_lo_ = true;
+  memcpy(rht->lo_, sep, KEY_SIZE);
+  rht->has_hi_ = has_hi_;
+  memcpy(rht->hi_, hi_, KEY_SIZE);
+  rht->prefix_len_ = rht->fence_prefix_len();
+  rht->max_size_ = capacity_of(rht->prefix_len_) - 1;
+  for(int i = 0; i < rht_size; ++i) {
+    full_key(lft_size + i, bytes);
+    rht->assign(i, bytes, values()[lft_size + i]);
+  }
+  rht->size_ = rht_size;
+  rht->rht_ptr_ = rht_ptr_;
+  rht_ptr_ = rht_ptr;
+
+  unsigned char old_prefix[KEY_SIZE];
+  int old_prefix_len = prefix_len_;
+  memcpy(old_prefix, lo_, old_prefix_len);
+  size_ = lft_size;
+  has_hi_ = true;
+  memcpy(hi_, sep, KEY_SIZE);
+  relayout(old_prefix, old_prefix_len);
+}
+
+template <class KeyT, class ValueT, size_t page_size> requires KeyEncodable<KeyT>
+bool BptPrefixLeafNode<KeyT, ValueT, page_size>::can_coalesce(const BptPrefixLeafNode *rht) const {
+  int prefix_len = (has_lo_ && rht->has_hi_) ? common_prefix(lo_, rht->hi_) : 0;
+  return size_ + rht->size_ <= static_cast<int>((capacity_of(prefix_len) - 1) * 0.90);
+}
+
+template <class KeyT, class ValueT, size_t page_size> requires KeyEncodable<KeyT>
+void BptPrefixLeafNode<KeyT, ValueT, page_size>::coalesce(BptPrefixLeafNode *rht) {
+  unsigned char old_prefix[KEY_SIZE], bytes[KEY_SIZE];
+  int old_prefix_len = prefix_len_;
+  memcpy(old_prefix, lo_, old_prefix_len);
+  has_hi_ = rht->has_hi_;
+  memcpy(hi_, rht->hi_, KEY_SIZE);
+  relayout(old_prefix, old_prefix_len);
+  if(size_ + rht->size_ > capacity_of(prefix_len_))
+    throw debug_exception("prefix leaf overflow");
+  for(int i = 0; i < rht->size_; ++i) {
+    rht->full_key(i, bytes);
+    assign(size_ + i, bytes, rht->values()[i]);
+  }
+  size_ += rht->size_;
+  rht->size_ = 0;
+  rht_ptr_ = rht->rht_ptr_;
+  rht->rht_ptr_ = NULL_PAGE_ID;
+}
+
+template <class KeyT, class ValueT, size_t page_size> requires KeyEncodable<KeyT>
+void BptPrefixLeafNode<KeyT, ValueT, page_size>::redistribute_left(BptPrefixLeafNode *lft) {
+  // nodes of different prefixes differ in capacity, so the smaller one may be the fuller one.
+  if(lft->size_ > size_) {
+    lft->redistribute_right(this);
+    return;
+  }
+  int lft_old_size = lft->size_, rht_old_size = size_;
+  int tot_size = lft_old_size + rht_old_size;
+  int lft_new_size = tot_size / 2, rht_new_size = tot_size - lft_new_size;
+  int diff = lft_new_size - lft_old_size;
+  unsigned char sep[KEY_SIZE], bytes[KEY_SIZE], old_prefix[KEY_SIZE];
+  full_key(diff, sep);
+
+  int old_prefix_len = lft->prefix_len_;
+  memcpy(old_prefix, lft->lo_, old_prefix_len);
+  lft->has_hi_ = true;
+  memcpy(lft->hi_, sep, KEY_SIZE);
+  lft->relayout(old_prefix, old_prefix_len);
+  if(lft_new_size > capacity_of(lft->prefix_len_))
+    throw debug_exception("prefix leaf overflow");
+  for(int i = 0; i < diff; ++i) {
+    full_key(i, bytes);
+    lft->assign(lft_old_size + i, bytes, values()[i]);
+  }
+  lft->size_ = lft_new_size;
+
+  memmove(values(), values() + diff, rht_new_size * sizeof(ValueT));
+  memmove(suffix(0), suffix(diff), rht_new_size * suffix_len());
+  size_ = rht_new_size;
+  old_prefix_len = prefix_len_;
+  memcpy(old_prefix, lo_, old_prefix_len);
+  has_lo_ = true;
+  memcpy(lo_, sep, KEY_SIZE);
+  relayout(old_prefix, old_prefix_len);
+}
+
+template <class KeyT, class ValueT, size_t page_size> requires KeyEncodable<KeyT>
+void BptPrefixLeafNode<KeyT, ValueT, page_size>::redistribute_right(BptPrefixLeafNode *rht) {
+  if(rht->size_ > size_) {
+    rht->redistribute_left(this);
+    return;
+  }
+  int lft_old_size = size_, rht_old_size = rht->size_;
+  int tot_size = lft_old_size + rht_old_size;
+  int lft_new_size = tot_size / 2, rht_new_size = tot_size - lft_new_size;
+  int diff = rht_new_size - rht_old_size;
+  unsigned char sep[KEY_SIZE], bytes[KEY_SIZE], old_prefix[KEY_SIZE];
+  full_key(lft_new_size, sep);
+
+  int old_prefix_len = rht->prefix_len_;
+  memcpy(old_prefix, rht->lo_, old_prefix_len);
+  rht->has_lo_ = true;
+  memcpy(rht->lo_, sep, KEY_SIZE);
+  rht->relayout(old_prefix, old_prefix_len);
+  if(rht_new_size > capacity_of(rht->prefix_len_))
+    throw debug_exception("prefix leaf overflow");
+  memmove(rht->values() + diff, rht->values(), rht_old_size * sizeof(ValueT));
+  memmove(rht->suffix(diff), rht->suffix(0), rht_old_size * rht->suffix_len());
+  for(int i = 0; i < diff; ++i) {
+    full_key(lft_new_size + i, bytes);
+    rht->assign(i, bytes, values()[lft_new_size + i]);
+  }
+  rht->size_ = rht_new_size;
+
+  old_prefix_len = prefix_len_;
+  memcpy(old_prefix, lo_, old_prefix_len);
+  size_ = lft_new_size;
+  has_hi_ = true;
+  memcpy(hi_, sep, KEY_SIZE);
+  relayout(old_prefix, old_prefix_len);
+}
+
+/**********************************************************************************************************************/
+
+template <class KeyT, size_t page_size>
+void BptInternalNode<KeyT, page_size>::init(int max_size) {
   node_type_ = NodeT::Internal;
   max_size_ = max_size;
   size_ = 0;
 }
 
-template <class KeyT>
+template <class KeyT, size_t page_size>
 template <class KeyCompare>
-int BptInternalNode<KeyT>::locate_key(const KeyT &key, KeyCompare key_compare) const {
+int BptInternalNode<KeyT, page_size>::locate_key(const KeyT &key, KeyCompare key_compare) const {
   int lft = 1, rht = size_ - 1;
   if(key_compare(key, storage_[lft].key))
     return lft - 1;
@@ -232,34 +495,34 @@ int BptInternalNode<KeyT>::locate_key(const KeyT &key, KeyCompare key_compare) c
   return rht;
 }
 
-template <class KeyT>
-void BptInternalNode<KeyT>::insert(int pos, const KeyT &key, page_id_t child) {
+template <class KeyT, size_t page_size>
+void BptInternalNode<KeyT, page_size>::insert(int pos, const KeyT &key, page_id_t child) {
   memmove(storage_ + pos + 1, storage_ + pos, (size_ - pos) * sizeof(Storage));
   storage_[pos] = {key, child};
   size_ += 1;
 }
 
-template <class KeyT>
-void BptInternalNode<KeyT>::remove(int pos) {
+template <class KeyT, size_t page_size>
+void BptInternalNode<KeyT, page_size>::remove(int pos) {
   memmove(storage_ + pos, storage_ + pos + 1, (size_ - pos - 1) * sizeof(Storage));
   size_ -= 1;
 }
 
-template <class KeyT>
-void BptInternalNode<KeyT>::update(int pos, const KeyT &key) {
+template <class KeyT, size_t page_size>
+void BptInternalNode<KeyT, page_size>::update(int pos, const KeyT &key) {
   storage_[pos].key = key;
 }
 
-template <class KeyT>
-void BptInternalNode<KeyT>::split(BptInternalNode *rht) {
+template <class KeyT, size_t page_size>
+void BptInternalNode<KeyT, page_size>::split(BptInternalNode *rht) {
   int lft_size = size_ / 2, rht_size = size_ - lft_size;
   memcpy(rht->storage_, storage_ + lft_size, rht_size * sizeof(Storage));
   size_ = lft_size;
   rht->size_ = rht_size;
 }
 
-template <class KeyT>
-void BptInternalNode<KeyT>::coalesce(BptInternalNode *rht) {
+template <class KeyT, size_t page_size>
+void BptInternalNode<KeyT, page_size>::coalesce(BptInternalNode *rht) {
   int lft_old_size = size_, rht_old_size = rht->size_;
   int tot_size = lft_old_size + rht_old_size;
   memcpy(storage_ + lft_old_size, rht->storage_, rht_old_size * sizeof(Storage));
@@ -267,8 +530,8 @@ void BptInternalNode<KeyT>::coalesce(BptInternalNode *rht) {
   rht->size_ = 0;
 }
 
-template <class KeyT>
-void BptInternalNode<KeyT>::redistribute_left(BptInternalNode *lft) {
+template <class KeyT, size_t page_size>
+void BptInternalNode<KeyT, page_size>::redistribute_left(BptInternalNode *lft) {
   int lft_old_size = lft->size_, rht_old_size = size_;
   int tot_size = lft_old_size + rht_old_size;
   int lft_new_size = tot_size / 2, rht_new_size = tot_size - lft_new_size;
@@ -279,8 +542,8 @@ void BptInternalNode<KeyT>::redistribute_left(BptInternalNode *lft) {
   size_ = rht_new_size;
 }
 
-template <class KeyT>
-void BptInternalNode<KeyT>::redistribute_right(BptInternalNode *rht) {
+template <class KeyT, size_t page_size>
+void BptInternalNode<KeyT, page_size>::redistribute_right(BptInternalNode *rht) {
   int lft_old_size = size_, rht_old_size = rht->size_;
   int tot_size = lft_old_size + rht_old_size;
   int lft_new_size = tot_size / 2, rht_new_size = tot_size - lft_new_size;
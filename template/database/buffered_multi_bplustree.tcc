@@ -0,0 +1,201 @@
+#ifndef INSOMNIA_BUFFERED_MULTI_BPLUSTREE_TCC
+#define INSOMNIA_BUFFERED_MULTI_BPLUSTREE_TCC
+
+#include "buffered_multi_bplustree.h"
+
+namespace insomnia {
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+BufferedMultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::BufferedMultiBplustree(
+  const std::filesystem::path &path, int buffer_capacity, int replacer_k_arg, size_t message_capacity)
+    : tree_(path, buffer_capacity, replacer_k_arg), message_capacity_(std::max<size_t>(message_capacity, 1)) {
+  buffer_.reserve(message_capacity_);
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+vector<ValueT> BufferedMultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::search(const KeyT &key) {
+  vector<ValueT> result;
+  for_each_equal(key, [&result](const ValueT &value) { result.push_back(value); });
+  return result;
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+bool BufferedMultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::insert(
+  const KeyT &key, const ValueT &value) {
+  buffer_.push_back(Message{key, value, MessageType::Insert, seq_++});
+  if(buffer_.size() >= message_capacity_)
+    flush();
+  return true;
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+bool BufferedMultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::remove(
+  const KeyT &key, const ValueT &value) {
+  buffer_.push_back(Message{key, value, MessageType::Remove, seq_++});
+  if(buffer_.size() >= message_capacity_)
+    flush();
+  return true;
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+void BufferedMultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::flush() {
+  settle();
+  // in key order, so that consecutive messages mostly land in the same (cached) leaf.
+  for(const auto &msg : buffer_) {
+    switch(msg.type) {
+    case MessageType::Insert:
+      tree_.insert(msg.key, msg.value);
+      break;
+    case MessageType::Remove:
+      tree_.remove(msg.key, msg.value);
+      break;
+    case MessageType::Replace:
+      tree_.remove(msg.key, msg.value);
+      tree_.insert(msg.key, msg.value);
+      break;
+    }
+  }
+  buffer_.clear();
+  sorted_cnt_ = 0;
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+void BufferedMultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::settle() {
+  if(sorted_cnt_ == buffer_.size())
+    return;
+  auto msg_less = [this](const Message &lhs, const Message &rhs) {
+    if(kv_less(lhs.key, lhs.value, rhs.key, rhs.value))
+      return true;
+    if(kv_less(rhs.key, rhs.value, lhs.key, lhs.value))
+      return false;
+    return lhs.seq < rhs.seq;
+  };
+  insomnia::sort(buffer_.begin() + sorted_cnt_, buffer_.end(), msg_less);
+  vector<Message> merged;
+  merged.reserve(message_capacity_);
+  size_t i = 0, j = sorted_cnt_;
+  while(i < sorted_cnt_ || j < buffer_.size()) {
+    auto &msg = (j == buffer_.size() || (i < sorted_cnt_ && msg_less(buffer_[i], buffer_[j]))) ?
+      buffer_[i++] : buffer_[j++];
+    if(merged.empty() || kv_less(merged.back().key, merged.back().value, msg.key, msg.value)) {
+      merged.push_back(std::move(msg));
+      continue;
+    }
+    // msg is a later one about the same pair.
+    auto &folded = merged.back();
+    if(msg.type == MessageType::Remove)
+      // the insertion might have been a duplicate of a stored pair, so the removal stays.
+      folded.type = MessageType::Remove;
+    else if(folded.type == MessageType::Remove) {
+      folded.value = msg.value;
+      folded.type = MessageType::Replace;
+    }
+    // an insertion after an insertion is a duplicate and dropped.
+  }
+  buffer_ = std::move(merged);
+  sorted_cnt_ = buffer_.size();
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+template <class Func>
+void BufferedMultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::for_each_equal(
+  const KeyT &key, Func &&fn) {
+  merged_walk(key, key, [&fn](const auto &, const ValueT &value, auto &&) {
+    if constexpr (std::is_same_v<std::invoke_result_t<Func&, const ValueT&>, bool>) {
+      return fn(value);
+    } else {
+      fn(value);
+      return true;
+    }
+  });
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+template <class Pred, class Visit>
+size_t BufferedMultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::scan(
+  const KeyT &lo, const KeyT &hi, Pred &&pred, size_t limit, Visit &&visit) {
+  size_t matched = 0;
+  if(limit == 0)
+    return matched;
+  merged_walk(lo, hi, [&](const auto &key, const ValueT &value, auto &&get_mut) {
+    if(!pred(key, value))
+      return true;
+    visit(key, get_mut());
+    return ++matched != limit;
+  });
+  return matched;
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+template <class Pred>
+vector<pair<KeyT, ValueT>> BufferedMultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::scan(
+  const KeyT &lo, const KeyT &hi, Pred &&pred, size_t limit) {
+  vector<pair<KeyT, ValueT>> result;
+  scan(lo, hi, std::forward<Pred>(pred), limit, [&result](const KeyT &key, const ValueT &value) {
+    result.push_back(pair<KeyT, ValueT>(key, value));
+  });
+  return result;
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+size_t BufferedMultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::locate_key(const KeyT &key) const {
+  size_t lo = 0, hi = buffer_.size();
+  while(lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if(key_compare_(buffer_[mid].key, key))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+template <class Func>
+void BufferedMultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::merged_walk(
+  const KeyT &lo, const KeyT &hi, Func &&fn) {
+  settle();
+  auto it = tree_.find_upper(lo);
+  auto pos = locate_key(lo);
+  while(true) {
+    bool has_entry = it.is_valid() && !key_compare_(hi, it.view().first);
+    bool has_msg = pos < buffer_.size() && !key_compare_(hi, buffer_[pos].key);
+    if(!has_entry && !has_msg)
+      return;
+    // < 0: the tree entry comes first; > 0: the message; 0: the message is about the entry.
+    int order;
+    if(!has_msg)
+      order = -1;
+    else if(!has_entry)
+      order = 1;
+    else {
+      auto entry = it.view();
+      const auto &msg = buffer_[pos];
+      if(kv_less(entry.first, entry.second, msg.key, msg.value))
+        order = -1;
+      else if(kv_less(msg.key, msg.value, entry.first, entry.second))
+        order = 1;
+      else
+        order = 0;
+    }
+    auto entry_mut = [&it]() -> ValueT& { return (*it).second; };
+    if(order < 0 || (order == 0 && buffer_[pos].type == MessageType::Insert)) {
+      // untouched, or re-inserted (which is dropped when applied).
+      auto entry = it.view();
+      if(!fn(entry.first, entry.second, entry_mut))
+        return;
+    } else if(buffer_[pos].type != MessageType::Remove) {
+      auto &msg = buffer_[pos];
+      if(!fn(msg.key, msg.value, [&msg]() -> ValueT& { return msg.value; }))
+        return;
+    }
+    if(order <= 0)
+      ++it;
+    if(order >= 0)
+      ++pos;
+  }
+}
+
+}
+
+#endif
@@ -0,0 +1,245 @@
+#ifndef INSOMNIA_EXTENDIBLE_HASH_TCC
+#define INSOMNIA_EXTENDIBLE_HASH_TCC
+
+#include "extendible_hash.h"
+
+namespace insomnia {
+
+template <class KeyT, class ValueT, class Hash, class KeyEqual>
+ExtendibleHashTable<KeyT, ValueT, Hash, KeyEqual>::ExtendibleHashTable(
+  const std::filesystem::path &path, int buffer_capacity, int replacer_k_arg, size_t filter_bits_per_key)
+    : buf_pool_(path.string() + "-hash", buffer_capacity, replacer_k_arg),
+      dir_pool_(path.string() + "-hash_dir", 2, replacer_k_arg),
+      global_depth_(0), dir_page_cnt_(0), size_(0),
+      filter_bits_(filter_bits_per_key), filter_path_(path.string() + "-hash_bloom"),
+      filter_(std::max<size_t>(filter_bits_per_key, 1)) {
+  Meta meta;
+  if(!buf_pool_.read_meta(&meta)) {
+    std::filesystem::remove(filter_path_);
+    return;
+  }
+  global_depth_ = meta.global_depth;
+  dir_page_cnt_ = meta.dir_page_cnt;
+  size_ = meta.size;
+  // directory pages are never freed, so they sit at page 1, 2, ...
+  dir_.reserve(meta.slot_cnt);
+  for(page_id_t page_id = 1; dir_.size() < meta.slot_cnt; ++page_id) {
+    auto visitor = dir_pool_.visitor(page_id);
+    auto page = visitor.template as<DirPage>();
+    for(size_t i = 0; i < DirPage::SLOT_CNT && dir_.size() < meta.slot_cnt; ++i)
+      dir_.push_back(page->slots[i]);
+  }
+  // one saved earlier would miss the keys inserted while it was off.
+  if(filter_bits_ == 0)
+    std::filesystem::remove(filter_path_);
+  else if(!filter_.load(filter_path_))
+    rebuild_filter();
+}
+
+template <class KeyT, class ValueT, class Hash, class KeyEqual>
+ExtendibleHashTable<KeyT, ValueT, Hash, KeyEqual>::~ExtendibleHashTable() {
+  int page_cnt = (dir_.size() + DirPage::SLOT_CNT - 1) / DirPage::SLOT_CNT;
+  for(; dir_page_cnt_ < page_cnt; ++dir_page_cnt_)
+    dir_pool_.alloc();
+  for(int i = 0; i < page_cnt; ++i) {
+    auto visitor = dir_pool_.visitor(i + 1);
+    auto page = visitor.template as_mut<DirPage>();
+    for(size_t j = 0; j < DirPage::SLOT_CNT && i * DirPage::SLOT_CNT + j < dir_.size(); ++j)
+      page->slots[j] = dir_[i * DirPage::SLOT_CNT + j];
+  }
+  Meta meta {global_depth_, dir_page_cnt_, dir_.size(), size_};
+  buf_pool_.write_meta(&meta);
+  if(filter_bits_ > 0)
+    filter_.save(filter_path_);
+}
+
+template <class KeyT, class ValueT, class Hash, class KeyEqual>
+void ExtendibleHashTable<KeyT, ValueT, Hash, KeyEqual>::rebuild_filter() {
+  filter_.reset(size_ * 2);
+  for(auto it = begin(); it != end(); ++it)
+    filter_.insert(hash_(it.view().first));
+}
+
+template <class KeyT, class ValueT, class Hash, class KeyEqual>
+optional<ValueT> ExtendibleHashTable<KeyT, ValueT, Hash, KeyEqual>::search(const KeyT &key) {
+  if(surely_absent(key))
+    return optional<ValueT>();
+  auto it = find(key);
+  if(it == end())
+    return optional<ValueT>();
+  return make_optional<ValueT>(it.view().second);
+}
+
+template <class KeyT, class ValueT, class Hash, class KeyEqual>
+bool ExtendibleHashTable<KeyT, ValueT, Hash, KeyEqual>::insert(const KeyT &key, const ValueT &value) {
+  if(dir_.empty()) {
+    auto page_id = buf_pool_.alloc();
+    auto visitor = buf_pool_.visitor(page_id);
+    visitor.template as_mut<Bucket>()->init(0);
+    dir_.push_back(page_id);
+    global_depth_ = 0;
+  }
+  if(filter_bits_ > 0) {
+    // a key already there is added again, which does no harm.
+    if(filter_.overfull())
+      rebuild_filter();
+    filter_.insert(hash_(key));
+  }
+  while(true) {
+    auto slot = slot_of(key);
+    auto visitor = buf_pool_.visitor(dir_[slot]);
+    auto bucket = visitor.template as<Bucket>();
+    if(bucket->locate(key, key_equal_) != bucket->size())
+      return false;
+    if(!bucket->full()) {
+      visitor.template as_mut<Bucket>()->insert(key, value);
+      ++size_;
+      return true;
+    }
+    visitor.drop();
+    split(slot);
+  }
+}
+
+template <class KeyT, class ValueT, class Hash, class KeyEqual>
+bool ExtendibleHashTable<KeyT, ValueT, Hash, KeyEqual>::remove(const KeyT &key) {
+  // the key stays in the filter until it is rebuilt.
+  if(dir_.empty() || surely_absent(key))
+    return false;
+  auto slot = slot_of(key);
+  auto visitor = buf_pool_.visitor(dir_[slot]);
+  auto pos = visitor.template as<Bucket>()->locate(key, key_equal_);
+  if(pos == visitor.template as<Bucket>()->size())
+    return false;
+  auto bucket = visitor.template as_mut<Bucket>();
+  bucket->remove(pos);
+  --size_;
+  if(bucket->size() == 0) {
+    visitor.drop();
+    merge(slot);
+  }
+  return true;
+}
+
+template <class KeyT, class ValueT, class Hash, class KeyEqual>
+void ExtendibleHashTable<KeyT, ValueT, Hash, KeyEqual>::split(size_t slot) {
+  auto visitor = buf_pool_.visitor(dir_[slot]);
+  auto bucket = visitor.template as_mut<Bucket>();
+  int local_depth = bucket->local_depth();
+  if(local_depth == global_depth_) {
+    if(global_depth_ == GLOBAL_DEPTH_LIM)
+      throw database_exception("Extendible hash error: directory too deep");
+    size_t slot_cnt = dir_.size();
+    dir_.reserve(slot_cnt * 2);
+    for(size_t i = 0; i < slot_cnt; ++i)
+      dir_.push_back(dir_[i]);
+    ++global_depth_;
+  }
+  auto new_page_id = buf_pool_.alloc();
+  auto new_visitor = buf_pool_.visitor(new_page_id);
+  auto new_bucket = new_visitor.template as_mut<Bucket>();
+  new_bucket->init(local_depth + 1);
+  bucket->set_local_depth(local_depth + 1);
+  size_t bit = size_t(1) << local_depth;
+  for(int pos = 0; pos < bucket->size(); ) {
+    if(hash_(bucket->key(pos)) & bit) {
+      new_bucket->insert(bucket->key(pos), bucket->value(pos));
+      bucket->remove(pos);
+    } else {
+      ++pos;
+    }
+  }
+  for(size_t i = slot & (bit - 1); i < dir_.size(); i += bit)
+    if(i & bit)
+      dir_[i] = new_page_id;
+}
+
+template <class KeyT, class ValueT, class Hash, class KeyEqual>
+void ExtendibleHashTable<KeyT, ValueT, Hash, KeyEqual>::merge(size_t slot) {
+  while(true) {
+    auto page_id = dir_[slot];
+    auto visitor = buf_pool_.visitor(page_id);
+    int local_depth = visitor.template as<Bucket>()->local_depth();
+    if(visitor.template as<Bucket>()->size() != 0 || local_depth == 0)
+      break;
+    visitor.drop();
+    size_t bit = size_t(1) << (local_depth - 1);
+    auto buddy_slot = slot ^ bit;
+    auto buddy_page_id = dir_[buddy_slot];
+    auto buddy_visitor = buf_pool_.visitor(buddy_page_id);
+    if(buddy_visitor.template as<Bucket>()->local_depth() != local_depth)
+      break;
+    buddy_visitor.template as_mut<Bucket>()->set_local_depth(local_depth - 1);
+    for(size_t i = slot & (bit - 1); i < dir_.size(); i += bit)
+      if(dir_[i] == page_id)
+        dir_[i] = buddy_page_id;
+    buf_pool_.dealloc(page_id);
+    // the buddy may be empty as well.
+    slot = buddy_slot;
+  }
+  while(global_depth_ > 0) {
+    size_t half = dir_.size() / 2;
+    for(size_t i = 0; i < half; ++i)
+      if(dir_[i] != dir_[i + half])
+        return;
+    dir_.resize(half);
+    --global_depth_;
+  }
+}
+
+template <class KeyT, class ValueT, class Hash, class KeyEqual>
+void ExtendibleHashTable<KeyT, ValueT, Hash, KeyEqual>::iterator::settle() {
+  while(slot_ < table_->dir_.size()) {
+    if(!visitor_.is_valid()) {
+      visitor_ = table_->buf_pool_.visitor(table_->dir_[slot_]);
+      // slots beyond 2^local_depth alias a bucket that was met before.
+      if(slot_ >> visitor_.template as<Bucket>()->local_depth() != 0) {
+        visitor_.drop();
+        ++slot_;
+        continue;
+      }
+      pos_ = 0;
+    }
+    if(pos_ < visitor_.template as<Bucket>()->size())
+      return;
+    visitor_.drop();
+    ++slot_;
+  }
+}
+
+template <class KeyT, class ValueT, class Hash, class KeyEqual>
+typename ExtendibleHashTable<KeyT, ValueT, Hash, KeyEqual>::iterator&
+  ExtendibleHashTable<KeyT, ValueT, Hash, KeyEqual>::iterator::operator++() {
+  if(!visitor_.is_valid()) throw invalid_iterator();
+  ++pos_;
+  settle();
+  return *this;
+}
+
+template <class KeyT, class ValueT, class Hash, class KeyEqual>
+typename ExtendibleHashTable<KeyT, ValueT, Hash, KeyEqual>::iterator
+ExtendibleHashTable<KeyT, ValueT, Hash, KeyEqual>::begin() {
+  iterator it(this, Visitor(), 0, 0);
+  it.settle();
+  return it;
+}
+
+template <class KeyT, class ValueT, class Hash, class KeyEqual>
+typename ExtendibleHashTable<KeyT, ValueT, Hash, KeyEqual>::iterator
+ExtendibleHashTable<KeyT, ValueT, Hash, KeyEqual>::find(const KeyT &key) {
+  if(dir_.empty() || surely_absent(key))
+    return end();
+  auto slot = slot_of(key);
+  auto visitor = buf_pool_.visitor(dir_[slot]);
+  auto bucket = visitor.template as<Bucket>();
+  auto pos = bucket->locate(key, key_equal_);
+  if(pos == bucket->size())
+    return end();
+  // iteration goes on from the lowest slot of the bucket.
+  slot &= (size_t(1) << bucket->local_depth()) - 1;
+  return iterator(this, std::move(visitor), slot, pos);
+}
+
+}
+
+#endif
@@ -5,29 +5,52 @@
 
 namespace insomnia {
 
-template <class KeyT, class ValueT, class KeyCompare, class ValueCompare>
-MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare>::MultiBplustree(
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::MultiBplustree(
   const std::filesystem::path &path, int buffer_capacity, int replacer_k_arg)
     : buf_pool_(path.string() + "-mult_bpt", buffer_capacity, replacer_k_arg) {
   if(!buf_pool_.read_meta(&root_ptr_))
     root_ptr_ = NULL_PAGE_ID;
 }
 
-template <class KeyT, class ValueT, class KeyCompare, class ValueCompare>
-MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare>::~MultiBplustree() {
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::~MultiBplustree() {
   buf_pool_.write_meta(&root_ptr_);
 }
 
-template <class KeyT, class ValueT, class KeyCompare, class ValueCompare>
-vector<ValueT> MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare>::search(const KeyT &key) {
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+vector<ValueT> MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::search(const KeyT &key) {
   vector<ValueT> result;
-  for(auto it = find_upper(key); it != end() && key_equal(it.view().first, key); ++it)
-    result.push_back(it.view().second);
+  for_each_equal(key, [&result](const ValueT &value) { result.push_back(value); });
   return result;
 }
 
-template <class KeyT, class ValueT, class KeyCompare, class ValueCompare>
-bool MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare>::insert(const KeyT &key, const ValueT &value) {
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+template <class Func>
+void MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::for_each_equal(const KeyT &key, Func &&fn) {
+  auto it = find_upper(key);
+  while(it.is_valid()) {
+    const auto *leaf = it.visitor_.template as<Leaf>();
+    for(int pos = it.pos_; pos < leaf->size(); ++pos) {
+      if(key_compare_(key, leaf->key(pos)))
+        return;
+      if constexpr (std::is_same_v<std::invoke_result_t<Func&, const ValueT&>, bool>) {
+        if(!fn(leaf->value(pos)))
+          return;
+      } else {
+        fn(leaf->value(pos));
+      }
+    }
+    auto rht_ptr = leaf->rht_ptr();
+    if(rht_ptr == NULL_PAGE_ID)
+      return;
+    it.visitor_ = buf_pool_.visitor(rht_ptr);
+    it.pos_ = 0;
+  }
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+bool MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::insert(const KeyT &key, const ValueT &value) {
   if(root_ptr_ == NULL_PAGE_ID) {
     root_ptr_ = buf_pool_.alloc();
     auto visitor = buf_pool_.visitor(root_ptr_);
@@ -37,12 +60,14 @@ bool MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare>::insert(const KeyT &
     return true;
   }
   vector<Visitor> visitors;
-  visitors.push_back(buf_pool_.visitor(root_ptr_));
+  vector<int> path_pos;
+  visitors.push_back(node_visitor(root_ptr_));
   while(!visitors.back().template as<Base>()->is_leaf()) {
     auto node = visitors.back().template as<Internal>();
     auto pos = node->locate_pair(key, value, kv_compare_);
     auto ptr = node->child(pos);
-    visitors.push_back(buf_pool_.visitor(ptr));
+    path_pos.push_back(pos);
+    visitors.push_back(node_visitor(ptr));
   }
   auto leaf_visitor = std::move(visitors.back());
   visitors.pop_back();
@@ -53,8 +78,12 @@ bool MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare>::insert(const KeyT &
     value_equal(leaf_immut->value(leaf_pos), value))
     return false;
   auto leaf = leaf_visitor.template as_mut<Leaf>();
-  leaf->insert(leaf_pos, key, value);
-  if(!leaf->too_large())
+  // a key that widens the fences of a prefix leaf may only fit into one of its halves.
+  const bool fits = leaf->fits(key);
+  if(fits)
+    leaf->insert(leaf_pos, key, value);
+  update_path_count(visitors, path_pos, 1);
+  if(fits && !leaf->too_large())
     return true;
 
   {
@@ -63,20 +92,25 @@ bool MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare>::insert(const KeyT &
     auto rht_leaf = rht_visitor.template as_mut<Leaf>();
     rht_leaf->init();
     leaf->split(rht_leaf, rht_ptr);
+    if(!fits) {
+      auto half = kv_compare_(key, value, rht_leaf->key(0), rht_leaf->value(0)) ? leaf : rht_leaf;
+      half->insert(half->locate_pair(key, value, kv_compare_), key, value);
+    }
     if(visitors.empty()) {
       auto root_ptr = buf_pool_.alloc();
       auto root_visitor = buf_pool_.visitor(root_ptr);
       auto root = root_visitor.template as_mut<Internal>();
       root->init();
-      root->insert(0, leaf->key(0), leaf->value(0), root_ptr_);
-      root->insert(1, rht_leaf->key(0), rht_leaf->value(0), rht_ptr);
+      root->insert(0, leaf->key(0), leaf->value(0), root_ptr_, leaf->size());
+      root->insert(1, rht_leaf->key(0), rht_leaf->value(0), rht_ptr, rht_leaf->size());
       root_ptr_ = root_ptr;
       return true;
     }
     auto &parent_visitor = visitors.back();
     auto parent_node = parent_visitor.template as_mut<Internal>();
     auto pos = parent_node->locate_pair(rht_leaf->key(0), rht_leaf->value(0), kv_compare_);
-    parent_node->insert(pos + 1, rht_leaf->key(0), rht_leaf->value(0), rht_ptr);
+    parent_node->set_count(pos, leaf->size());
+    parent_node->insert(pos + 1, rht_leaf->key(0), rht_leaf->value(0), rht_ptr, rht_leaf->size());
   }
   leaf_visitor.drop();
   while(visitors.size() > 1) {
@@ -93,7 +127,8 @@ bool MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare>::insert(const KeyT &
     auto &parent_visitor = visitors.back();
     auto parent_node = parent_visitor.template as_mut<Internal>();
     auto pos = parent_node->locate_pair(rht_node->key(0), rht_node->value(0), kv_compare_);
-    parent_node->insert(pos + 1, rht_node->key(0), rht_node->value(0), rht_ptr);
+    parent_node->set_count(pos, node->total());
+    parent_node->insert(pos + 1, rht_node->key(0), rht_node->value(0), rht_ptr, rht_node->total());
   }
   auto root_visitor = std::move(visitors.back());
   visitors.pop_back();
@@ -109,127 +144,740 @@ bool MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare>::insert(const KeyT &
   auto new_root_visitor = buf_pool_.visitor(new_root_ptr);
   auto new_root_node = new_root_visitor.template as_mut<Internal>();
   new_root_node->init();
-  new_root_node->insert(0, root_node->key(0), root_node->value(0), root_ptr_);
-  new_root_node->insert(1, rht_node->key(0), rht_node->value(0), rht_ptr);
+  new_root_node->insert(0, root_node->key(0), root_node->value(0), root_ptr_, root_node->total());
+  new_root_node->insert(1, rht_node->key(0), rht_node->value(0), rht_ptr, rht_node->total());
   root_ptr_ = new_root_ptr;
   return true;
 }
 
-template <class KeyT, class ValueT, class KeyCompare, class ValueCompare>
-bool MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare>::remove(const KeyT &key, const ValueT &value) {
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+bool MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::remove(const KeyT &key, const ValueT &value) {
   if(root_ptr_ == NULL_PAGE_ID)
     return false;
   vector<Visitor> visitors;
-  visitors.push_back(buf_pool_.visitor(root_ptr_));
-  while(!visitors.back().template as<Base>()->is_leaf()) {
-    auto node = visitors.back().template as<Internal>();
-    auto pos = node->locate_pair(key, value, kv_compare_);
-    auto ptr = node->child(pos);
-    visitors.push_back(buf_pool_.visitor(ptr));
-  }
-  auto leaf_visitor = std::move(visitors.back());
-  visitors.pop_back();
-  auto leaf_immut = leaf_visitor.template as<Leaf>();
+  vector<int> path_pos;
+  descend(visitors, path_pos, [&](const Internal *node) { return node->locate_pair(key, value, kv_compare_); });
+  auto leaf_immut = visitors.back().template as<Leaf>();
   auto leaf_pos = leaf_immut->locate_pair(key, value, kv_compare_);
   if(leaf_pos == leaf_immut->size() ||
     !key_equal(leaf_immut->key(leaf_pos), key) ||
     !value_equal(leaf_immut->value(leaf_pos), value))
     return false;
-  auto leaf = leaf_visitor.template as_mut<Leaf>();
-  leaf->remove(leaf_pos);
-  if(!leaf->too_small())
-    return true;
-  {
-    if(visitors.empty()) {
-      if(leaf->size() == 0) {
-        leaf_visitor.drop();
-        buf_pool_.dealloc(root_ptr_);
-        root_ptr_ = NULL_PAGE_ID;
+  visitors.back().template as_mut<Leaf>()->remove(leaf_pos);
+  update_path_count(visitors, path_pos, -1);
+  while(visitors.size() > 1 && visitors.back().template as<Base>()->too_small()) {
+    rebalance(visitors, path_pos);
+    visitors.pop_back();
+    path_pos.pop_back();
+  }
+  if(visitors.size() == 1) {
+    visitors.clear();
+    shrink_root();
+  }
+  return true;
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+void MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::remove_range(const KeyT &lo, const KeyT &hi) {
+  if(root_ptr_ == NULL_PAGE_ID || key_compare_(hi, lo))
+    return;
+  // the first child that may hold lo, and the last one that may hold hi.
+  auto locate_lo = [&](const Internal *node) { return node->locate_key(lo, key_compare_); };
+  auto locate_hi = [&](const Internal *node) {
+    return node->locate_pair(hi, ValueT{}, [&](const KeyT &k1, const ValueT &, const KeyT &k2, const ValueT &) {
+      return key_compare_(k1, k2);
+    });
+  };
+  auto weight = [](const Visitor &visitor) -> size_t {
+    if(visitor.template as<Base>()->is_leaf())
+      return visitor.template as<Leaf>()->size();
+    return visitor.template as<Internal>()->total();
+  };
+  // cut the leaf holding lo.
+  vector<Visitor> lft_path;
+  vector<int> lft_pos;
+  descend(lft_path, lft_pos, locate_lo);
+  const int height = lft_pos.size();
+  int lft_size = lft_path.back().template as<Leaf>()->size();
+  int first = lft_path.back().template as<Leaf>()->locate_key(lo, key_compare_), last = first;
+  while(last < lft_size && !key_compare_(hi, lft_path.back().template as<Leaf>()->key(last)))
+    ++last;
+  if(first < last)
+    lft_path.back().template as_mut<Leaf>()->remove(first, last);
+  // the leaves after it down to the one holding hi: (mid_key, mid_value) is the lower fence of the next one.
+  optional<KeyT> mid_key;
+  ValueT mid_value {};
+  if(last == lft_size) {
+    for(int i = height - 1; i >= 0; --i) {
+      auto node = lft_path[i].template as<Internal>();
+      if(lft_pos[i] + 1 < node->size()) {
+        mid_key = node->key(lft_pos[i] + 1);
+        mid_value = node->value(lft_pos[i] + 1);
+        break;
       }
-      return true;
     }
-    auto &parent_visitor = visitors.back();
-    auto parent_node = parent_visitor.template as_mut<Internal>();
-    auto pos = parent_node->locate_pair(leaf->key(0), leaf->value(0), kv_compare_);
-    if(pos > 0) {
-      auto lft_writer = buf_pool_.visitor(parent_node->child(pos - 1));
-      auto lft_node = lft_writer.template as_mut<Leaf>();
-      if(lft_node->size() + leaf->size() <= lft_node->merge_bound()) {
-        lft_node->coalesce(leaf);
-        leaf_visitor.drop();
-        buf_pool_.dealloc(parent_node->child(pos));
-        parent_node->remove(pos);
-      } else {
-        lft_node->redistribute_right(leaf);
-        parent_node->update(pos, leaf->key(0), leaf->value(0));
+  }
+  auto locate_mid = [&](const Internal *node) { return node->locate_pair(*mid_key, mid_value, kv_compare_); };
+  vector<Visitor> mid_path, rht_path;
+  vector<int> mid_pos, rht_pos;
+  if(mid_key.has_value() && !key_compare_(hi, *mid_key)) {
+    auto mid_ptr = lft_path.back().template as<Leaf>()->rht_ptr();
+    descend(rht_path, rht_pos, locate_hi);
+    auto rht_leaf = rht_path.back().template as<Leaf>();
+    int cnt = 0;
+    while(cnt < rht_leaf->size() && !key_compare_(hi, rht_leaf->key(cnt)))
+      ++cnt;
+    if(cnt > 0)
+      rht_path.back().template as_mut<Leaf>()->remove(0, cnt);
+    if(mid_ptr != rht_path.back().page_id()) {
+      // the leaves from mid_ptr on up to the one holding hi are dropped, except mid_ptr itself,
+      // which is emptied and takes over their range, so that no fence has to widen on a
+      // non-empty leaf. The rebalancing below merges it away.
+      KeyT rht_key;
+      ValueT rht_value;
+      for(int i = height - 1; i >= 0; --i) {
+        if(rht_pos[i] > 0) {
+          auto node = rht_path[i].template as<Internal>();
+          rht_key = node->key(rht_pos[i]);
+          rht_value = node->value(rht_pos[i]);
+          break;
+        }
       }
-    } else {
-      auto rht_writer = buf_pool_.visitor(parent_node->child(pos + 1));
-      auto rht_node = rht_writer.template as_mut<Leaf>();
-      if(leaf->size() + rht_node->size() <= rht_node->merge_bound()) {
-        leaf->coalesce(rht_node);
-        rht_writer.drop();
-        buf_pool_.dealloc(parent_node->child(pos + 1));
-        parent_node->remove(pos + 1);
-      } else {
-        rht_node->redistribute_left(leaf);
-        parent_node->update(pos + 1, rht_node->key(0), rht_node->value(0));
+      descend(mid_path, mid_pos, locate_mid);
+      int lca = 0;
+      while(mid_pos[lca] == rht_pos[lca])
+        ++lca;
+      for(int i = height - 1; i > lca; --i) {
+        auto mid_node = mid_path[i].template as_mut<Internal>();
+        for(int pos = mid_node->size() - 1; pos > mid_pos[i]; --pos) {
+          free_subtree(mid_node->child(pos), height - i - 1);
+          mid_node->remove(pos);
+        }
+        auto rht_node = rht_path[i].template as_mut<Internal>();
+        for(int pos = rht_pos[i] - 1; pos >= 0; --pos) {
+          free_subtree(rht_node->child(pos), height - i - 1);
+          rht_node->remove(pos);
+        }
+        // the subtree now starts at the lower fence of the leaf holding hi.
+        rht_node->update(0, rht_key, rht_value);
+        rht_pos[i] = 0;
+      }
+      auto lca_node = mid_path[lca].template as_mut<Internal>();
+      for(int pos = rht_pos[lca] - 1; pos > mid_pos[lca]; --pos) {
+        free_subtree(lca_node->child(pos), height - lca - 1);
+        lca_node->remove(pos);
       }
+      lca_node->update(mid_pos[lca] + 1, rht_key, rht_value);
+      rht_pos[lca] = mid_pos[lca] + 1;
+      auto mid_leaf = mid_path.back().template as_mut<Leaf>();
+      mid_leaf->remove(0, mid_leaf->size());
+      mid_leaf->set_hi_fence(rht_key);
+      mid_leaf->set_rht_ptr(rht_path.back().page_id());
     }
   }
-  leaf_visitor.drop();
-  while(visitors.size() > 1) {
-    auto visitor = std::move(visitors.back());
-    visitors.pop_back();
-    if(!visitor.template as<Base>()->too_small())
-      return true;
-    auto node = visitor.template as_mut<Internal>();
+  // the subtree counts of the paths, bottom-up; the nodes off them kept their entries.
+  for(int i = height - 1; i >= 0; --i) {
+    lft_path[i].template as_mut<Internal>()->set_count(lft_pos[i], weight(lft_path[i + 1]));
+    if(!mid_path.empty())
+      mid_path[i].template as_mut<Internal>()->set_count(mid_pos[i], weight(mid_path[i + 1]));
+    if(!rht_path.empty())
+      rht_path[i].template as_mut<Internal>()->set_count(rht_pos[i], weight(rht_path[i + 1]));
+  }
+  lft_path.clear();
+  mid_path.clear();
+  rht_path.clear();
+  // rebalance the three paths top-down, until nothing is too small.
+  // A node whose parent is left with a single child waits for the next round.
+  vector<Visitor> visitors;
+  vector<int> path_pos;
+  bool changed = true;
+  for(int round = 0; changed && round <= 2 * height + 1; ++round) {
+    changed = false;
+    shrink_root();
+    for(size_t depth = 2; root_ptr_ != NULL_PAGE_ID; ++depth) {
+      bool reached = false;
+      auto probe = [&](auto &&locate) {
+        descend(visitors, path_pos, locate, depth);
+        if(visitors.size() == depth) {
+          reached = true;
+          if(visitors.back().template as<Base>()->too_small() &&
+             visitors[depth - 2].template as<Base>()->size() > 1) {
+            rebalance(visitors, path_pos);
+            changed = true;
+          }
+        }
+        visitors.clear();
+        path_pos.clear();
+      };
+      probe(locate_lo);
+      if(mid_key.has_value())
+        probe(locate_mid);
+      probe(locate_hi);
+      if(!reached)
+        break;
+    }
+  }
+  shrink_root();
+}
 
-    auto &parent_visitor = visitors.back();
-    auto parent_node = parent_visitor.template as_mut<Internal>();
-    auto pos = parent_node->locate_pair(node->key(0), node->value(0), kv_compare_);
-    if(pos > 0) {
-      auto lft_writer = buf_pool_.visitor(parent_node->child(pos - 1));
-      auto lft_node = lft_writer.template as_mut<Internal>();
-      if(lft_node->size() + node->size() <= lft_node->merge_bound()) {
-        lft_node->coalesce(node);
-        visitor.drop(); // Aww, my eyes.
-        buf_pool_.dealloc(parent_node->child(pos));
-        parent_node->remove(pos);
-      } else {
-        lft_node->redistribute_right(node);
-        parent_node->update(pos, node->key(0), node->value(0));
-      }
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+template <class Locate>
+void MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::descend(
+  vector<Visitor> &visitors, vector<int> &path_pos, Locate &&locate, size_t depth) {
+  visitors.push_back(node_visitor(root_ptr_));
+  while(visitors.size() < depth && !visitors.back().template as<Base>()->is_leaf()) {
+    auto node = visitors.back().template as<Internal>();
+    auto pos = locate(node);
+    path_pos.push_back(pos);
+    visitors.push_back(node_visitor(node->child(pos)));
+  }
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+void MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::rebalance(
+  vector<Visitor> &visitors, const vector<int> &path_pos) {
+  auto parent_node = visitors[visitors.size() - 2].template as_mut<Internal>();
+  if(visitors.back().template as<Base>()->is_leaf())
+    rebalance_with_sibling<Leaf>(visitors.back(), parent_node, path_pos.back());
+  else
+    rebalance_with_sibling<Internal>(visitors.back(), parent_node, path_pos.back());
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+template <class Node>
+void MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::rebalance_with_sibling(
+  Visitor &visitor, Internal *parent_node, int pos) {
+  auto weight = [](const Node *node) -> size_t {
+    if constexpr(std::is_same_v<Node, Leaf>)
+      return node->size();
+    else
+      return node->total();
+  };
+  auto node = visitor.template as_mut<Node>();
+  if(pos > 0) {
+    auto lft_writer = node_visitor(parent_node->child(pos - 1));
+    auto lft_node = lft_writer.template as_mut<Node>();
+    if(lft_node->can_coalesce(node)) {
+      lft_node->coalesce(node);
+      visitor.drop(); // Aww, my eyes.
+      dealloc_node(parent_node->child(pos));
+      parent_node->remove(pos);
+      parent_node->set_count(pos - 1, weight(lft_node));
     } else {
-      auto rht_writer = buf_pool_.visitor(parent_node->child(pos + 1));
-      auto rht_node = rht_writer.template as_mut<Internal>();
-      if(node->size() + rht_node->size() <= rht_node->merge_bound()) {
-        node->coalesce(rht_node);
-        rht_writer.drop();
-        buf_pool_.dealloc(parent_node->child(pos + 1));
-        parent_node->remove(pos + 1);
-      } else {
-        rht_node->redistribute_left(node);
-        parent_node->update(pos + 1, rht_node->key(0), rht_node->value(0));
+      lft_node->redistribute_right(node);
+      parent_node->update(pos, node->key(0), node->value(0));
+      parent_node->set_count(pos - 1, weight(lft_node));
+      parent_node->set_count(pos, weight(node));
+    }
+  } else {
+    auto rht_writer = node_visitor(parent_node->child(pos + 1));
+    auto rht_node = rht_writer.template as_mut<Node>();
+    if(node->can_coalesce(rht_node)) {
+      node->coalesce(rht_node);
+      rht_writer.drop();
+      dealloc_node(parent_node->child(pos + 1));
+      parent_node->remove(pos + 1);
+      parent_node->set_count(pos, weight(node));
+    } else {
+      rht_node->redistribute_left(node);
+      parent_node->update(pos + 1, rht_node->key(0), rht_node->value(0));
+      parent_node->set_count(pos, weight(node));
+      parent_node->set_count(pos + 1, weight(rht_node));
+    }
+  }
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+void MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::shrink_root() {
+  while(root_ptr_ != NULL_PAGE_ID) {
+    auto root_visitor = node_visitor(root_ptr_);
+    auto root = root_visitor.template as<Base>();
+    page_id_t new_root_ptr = NULL_PAGE_ID;
+    if(root->is_leaf()) {
+      if(root->size() > 0)
+        return;
+    } else {
+      if(root->size() > 1)
+        return;
+      new_root_ptr = root_visitor.template as<Internal>()->child(0);
+    }
+    root_visitor.drop();
+    dealloc_node(root_ptr_);
+    root_ptr_ = new_root_ptr;
+  }
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+void MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::free_subtree(page_id_t page_id, int levels) {
+  if(levels > 0) {
+    auto visitor = node_visitor(page_id);
+    auto node = visitor.template as<Internal>();
+    for(int pos = 0; pos < node->size(); ++pos)
+      free_subtree(node->child(pos), levels - 1);
+    visitor.drop();
+  }
+  dealloc_node(page_id);
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+BptStats MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::stats() {
+  BptStats stats;
+  vector<page_id_t> level, next_level, rht_ptrs;
+  if(root_ptr_ != NULL_PAGE_ID)
+    level.push_back(root_ptr_);
+  for(size_t depth = 0; !level.empty(); ++depth) {
+    next_level.clear();
+    for(const auto &page_id : level) {
+      auto visitor = node_visitor(page_id);
+      stats.add_node(depth, visitor.template as<Base>());
+      if(visitor.template as<Base>()->is_leaf()) {
+        rht_ptrs.push_back(visitor.template as<Leaf>()->rht_ptr());
+        continue;
       }
+      auto node = visitor.template as<Internal>();
+      for(int pos = 0; pos < node->size(); ++pos)
+        next_level.push_back(node->child(pos));
     }
+    if(next_level.empty())
+      stats.add_leaf_chain(level, rht_ptrs);
+    std::swap(level, next_level);
   }
-  auto root_visitor = std::move(visitors.back());
-  visitors.pop_back();
-  if(root_visitor.template as<Base>()->size() > 1)
+  stats.add_pages(buf_pool_.max_page_id(), buf_pool_.free_page_count());
+  return stats;
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+bool MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::compact_step(size_t budget) {
+  // pages cannot move under the read views.
+  if(buf_pool_.snapshot_count() > 0)
+    return false;
+  // pins are taken again as the nodes are visited on their new pages.
+  pinned_.clear();
+  pinned_cnt_ = 0;
+  if(root_ptr_ == NULL_PAGE_ID) {
+    compact_phase_ = CompactPhase::Idle;
+    buf_pool_.truncate(NULL_PAGE_ID);
     return true;
-  auto root_node = root_visitor.template as<Internal>();
-  auto new_root_ptr = root_node->child(0);
-  // root_node->remove(0);
-  root_visitor.drop();
-  buf_pool_.dealloc(root_ptr_);
-  root_ptr_ = new_root_ptr;
+  }
+  if(compact_phase_ == CompactPhase::Idle) {
+    auto it = begin();
+    compact_key_ = it.view().first;
+    compact_value_ = it.view().second;
+    compact_target_ = NULL_PAGE_ID + 1;
+    compact_phase_ = CompactPhase::Leaves;
+  }
+  size_t used = 0;
+  while(compact_phase_ == CompactPhase::Leaves && used < budget)
+    used += compact_leaf();
+  if(compact_phase_ != CompactPhase::Internals || used >= budget)
+    return false;
+  compact_internals();
+  compact_phase_ = CompactPhase::Idle;
+  return true;
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+size_t MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::compact_leaf() {
+  size_t used = 1;
+  vector<Visitor> visitors;
+  vector<int> path_pos;
+  descend(visitors, path_pos, [&](const Internal *node) {
+    return node->locate_pair(compact_key_, compact_value_, kv_compare_);
+  });
+  if(visitors.size() > 1) {
+    // only siblings under the same parent, which keeps at least two children.
+    auto &leaf_visitor = visitors[visitors.size() - 1];
+    auto &parent_visitor = visitors[visitors.size() - 2];
+    int pos = path_pos.back();
+    while(pos + 1 < parent_visitor.template as<Internal>()->size() &&
+          parent_visitor.template as<Internal>()->size() > 2) {
+      auto rht_ptr = parent_visitor.template as<Internal>()->child(pos + 1);
+      auto rht_visitor = node_visitor(rht_ptr);
+      if(!leaf_visitor.template as<Leaf>()->can_coalesce(rht_visitor.template as<Leaf>()))
+        break;
+      auto leaf = leaf_visitor.template as_mut<Leaf>();
+      leaf->coalesce(rht_visitor.template as_mut<Leaf>());
+      rht_visitor.drop();
+      dealloc_node(rht_ptr);
+      auto parent_node = parent_visitor.template as_mut<Internal>();
+      parent_node->set_count(pos, leaf->size());
+      parent_node->remove(pos + 1);
+      ++used;
+    }
+  }
+  // the cursor moves on to the separator in front of the next leaf, the lower bound the
+  // descents route by, rather than to a pair that may leave the tree before the next step.
+  compact_phase_ = CompactPhase::Internals;
+  for(int i = static_cast<int>(path_pos.size()) - 1; i >= 0; --i) {
+    auto node = visitors[i].template as<Internal>();
+    if(path_pos[i] + 1 < node->size()) {
+      compact_key_ = node->key(path_pos[i] + 1);
+      compact_value_ = node->value(path_pos[i] + 1);
+      compact_phase_ = CompactPhase::Leaves;
+      break;
+    }
+  }
+  auto leaf_ptr = visitors.back().page_id();
+  visitors.clear();
+  place_node(leaf_ptr, compact_target_++);
+  return used;
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+void MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::compact_internals() {
+  vector<page_id_t> internals;
+  {
+    auto visitor = node_visitor(root_ptr_);
+    if(!visitor.template as<Base>()->is_leaf())
+      internals.push_back(root_ptr_);
+  }
+  // breadth first, stopping above the leaves.
+  for(size_t i = 0; i < internals.size(); ++i) {
+    auto visitor = node_visitor(internals[i]);
+    auto node = visitor.template as<Internal>();
+    if(node_visitor(node->child(0)).template as<Base>()->is_leaf())
+      continue;
+    for(int pos = 0; pos < node->size(); ++pos)
+      internals.push_back(node->child(pos));
+  }
+  for(size_t i = 0; i < internals.size(); ++i) {
+    auto target = compact_target_++;
+    // the internal node living on target (if any) is moved away and has to be followed.
+    auto spare = place_node(internals[i], target);
+    for(size_t j = i + 1; j < internals.size(); ++j)
+      if(internals[j] == target) {
+        internals[j] = spare;
+        break;
+      }
+    internals[i] = target;
+  }
+  page_id_t max_page_id = root_ptr_;
+  for(const auto &page_id : internals) {
+    max_page_id = std::max(max_page_id, page_id);
+    auto visitor = node_visitor(page_id);
+    auto node = visitor.template as<Internal>();
+    for(int pos = 0; pos < node->size(); ++pos)
+      max_page_id = std::max(max_page_id, node->child(pos));
+  }
+  buf_pool_.truncate(max_page_id);
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+page_id_t MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::place_node(page_id_t page_id, page_id_t target) {
+  if(page_id == target)
+    return NULL_PAGE_ID;
+  page_id_t spare = NULL_PAGE_ID;
+  if(!buf_pool_.acquire(target)) {
+    spare = buf_pool_.alloc();
+    if(move_node(target, spare))
+      buf_pool_.acquire(target);
+    else {
+      // an unreachable page, free to overwrite.
+      buf_pool_.dealloc(spare);
+      spare = NULL_PAGE_ID;
+    }
+  }
+  move_node(page_id, target);
+  return spare;
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+bool MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::locate_node(
+  page_id_t page_id, vector<pair<page_id_t, int>> &trail) {
+  if(page_id == root_ptr_)
+    return true;
+  // the first pair of an internal node is no lower bound of its subtree (position 0 routes
+  // everything below the next separator), so the descent goes by the first pair of the
+  // leftmost leaf under the node, which passes through it.
+  KeyT key;
+  ValueT value;
+  {
+    auto visitor = node_visitor(page_id);
+    while(!visitor.template as<Base>()->is_leaf())
+      visitor = node_visitor(visitor.template as<Internal>()->child(0));
+    auto leaf = visitor.template as<Leaf>();
+    // only the root leaf goes empty.
+    if(leaf->size() == 0)
+      return false;
+    key = leaf->key(0);
+    value = leaf->value(0);
+  }
+  for(auto cur_ptr = root_ptr_; cur_ptr != page_id; ) {
+    auto visitor = node_visitor(cur_ptr);
+    if(visitor.template as<Base>()->is_leaf())
+      return false;
+    auto node = visitor.template as<Internal>();
+    auto pos = node->locate_pair(key, value, kv_compare_);
+    trail.push_back(pair<page_id_t, int>(cur_ptr, pos));
+    cur_ptr = node->child(pos);
+  }
+  return true;
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+bool MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::move_node(page_id_t from, page_id_t to) {
+  vector<pair<page_id_t, int>> trail;
+  if(!locate_node(from, trail))
+    return false;
+  bool is_leaf;
+  {
+    auto src = buf_pool_.visitor(from);
+    auto dst = buf_pool_.visitor(to);
+    is_leaf = src.template as<Base>()->is_leaf();
+    memcpy(static_cast<void*>(dst.template as_mut<Base>()), src.template as<Base>(),
+      std::max(sizeof(Internal), sizeof(Leaf)));
+  }
+  if(trail.empty())
+    root_ptr_ = to;
+  else
+    node_visitor(trail.back().first).template as_mut<Internal>()->set_child(trail.back().second, to);
+  if(is_leaf) {
+    // the left neighbour is the rightmost leaf left of the path at the deepest possible branch.
+    int depth = static_cast<int>(trail.size()) - 1;
+    while(depth >= 0 && trail[depth].second == 0)
+      --depth;
+    if(depth >= 0) {
+      auto visitor = node_visitor(
+        node_visitor(trail[depth].first).template as<Internal>()->child(trail[depth].second - 1));
+      while(!visitor.template as<Base>()->is_leaf()) {
+        auto node = visitor.template as<Internal>();
+        visitor = node_visitor(node->child(node->size() - 1));
+      }
+      visitor.template as_mut<Leaf>()->set_rht_ptr(to);
+    }
+  }
+  dealloc_node(from);
   return true;
 }
 
-template <class KeyT, class ValueT, class KeyCompare, class ValueCompare>
-typename MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare>::iterator&
-  MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare>::iterator::operator++() {
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+void MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::pin_internal_levels(int frame_budget) {
+  pinned_.clear();
+  pinned_cnt_ = 0;
+  pin_budget_ = frame_budget;
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+typename MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::Visitor
+MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::node_visitor(page_id_t page_id) {
+  if(static_cast<size_t>(page_id) < pinned_.size() && pinned_[page_id].is_valid())
+    return pinned_[page_id].share();
+  auto visitor = buf_pool_.visitor(page_id);
+  if(pinned_cnt_ < pin_budget_ && !visitor.template as<Base>()->is_leaf()) {
+    if(static_cast<size_t>(page_id) >= pinned_.size())
+      pinned_.resize(std::max<size_t>(static_cast<size_t>(page_id) + 1, pinned_.size() * 2));
+    pinned_[page_id] = visitor.share();
+    ++pinned_cnt_;
+  }
+  return visitor;
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+void MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::update_path_count(
+  vector<Visitor> &visitors, const vector<int> &path_pos, int diff) {
+  for(size_t i = 0; i < path_pos.size(); ++i) {
+    auto node = visitors[i].template as_mut<Internal>();
+    node->set_count(path_pos[i], node->count(path_pos[i]) + diff);
+  }
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+void MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::dealloc_node(page_id_t page_id) {
+  if(static_cast<size_t>(page_id) < pinned_.size() && pinned_[page_id].is_valid()) {
+    pinned_[page_id].drop();
+    --pinned_cnt_;
+  }
+  buf_pool_.dealloc(page_id);
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+template <class Pred, class Visit>
+size_t MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::scan(
+  const KeyT &lo, const KeyT &hi, Pred &&pred, size_t limit, Visit &&visit) {
+  size_t matched = 0;
+  if(limit == 0)
+    return matched;
+  auto it = find_upper(lo);
+  while(it.is_valid()) {
+    auto &visitor = it.visitor_;
+    for(int pos = it.pos_; pos < visitor.template as<Leaf>()->size(); ++pos) {
+      const auto *leaf = visitor.template as<Leaf>();
+      if(key_compare_(hi, leaf->key(pos)))
+        return matched;
+      if(!pred(leaf->key(pos), leaf->value(pos)))
+        continue;
+      auto leaf_mut = visitor.template as_mut<Leaf>();
+      visit(leaf_mut->key(pos), leaf_mut->value(pos));
+      if(++matched == limit)
+        return matched;
+    }
+    auto rht_ptr = visitor.template as<Leaf>()->rht_ptr();
+    if(rht_ptr == NULL_PAGE_ID)
+      return matched;
+    visitor = buf_pool_.visitor(rht_ptr);
+    it.pos_ = 0;
+  }
+  return matched;
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+template <class Pred>
+vector<pair<KeyT, ValueT>> MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::scan(
+  const KeyT &lo, const KeyT &hi, Pred &&pred, size_t limit) {
+  vector<pair<KeyT, ValueT>> result;
+  scan(lo, hi, std::forward<Pred>(pred), limit, [&result](const KeyT &key, const ValueT &value) {
+    result.push_back(pair<KeyT, ValueT>(key, value));
+  });
+  return result;
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+template <class Func>
+size_t MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::parallel_scan(size_t part_cnt, Func &&fn) {
+  if(root_ptr_ == NULL_PAGE_ID || part_cnt == 0)
+    return 0;
+  // go down level by level until there are enough subtrees to share out.
+  vector<page_id_t> level;
+  level.push_back(root_ptr_);
+  while(level.size() < part_cnt && !node_visitor(level[0]).template as<Base>()->is_leaf()) {
+    vector<page_id_t> next;
+    for(auto page_id : level) {
+      auto visitor = node_visitor(page_id);
+      auto node = visitor.template as<Internal>();
+      for(int pos = 0; pos < node->size(); ++pos)
+        next.push_back(node->child(pos));
+    }
+    level = std::move(next);
+  }
+  // the first leaf of each part; a part ends where the next one starts.
+  const size_t parts = std::min(part_cnt, level.size());
+  vector<page_id_t> firsts;
+  for(size_t part = 0; part < parts; ++part) {
+    auto visitor = node_visitor(level[part * level.size() / parts]);
+    while(!visitor.template as<Base>()->is_leaf())
+      visitor = node_visitor(visitor.template as<Internal>()->child(0));
+    firsts.push_back(visitor.page_id());
+  }
+  firsts.push_back(NULL_PAGE_ID);
+  // the buffer pool is not thread safe: the page table and the pins go under the latch.
+  std::mutex latch;
+  vector<std::exception_ptr> errors;
+  errors.resize(parts);
+  auto walk = [&](size_t part) {
+    Visitor visitor;
+    try {
+      for(page_id_t page_id = firsts[part]; page_id != firsts[part + 1]; ) {
+        {
+          std::lock_guard<std::mutex> lock(latch);
+          visitor.drop();
+          visitor = buf_pool_.visitor(page_id);
+        }
+        auto leaf = visitor.template as<Leaf>();
+        for(int pos = 0; pos < leaf->size(); ++pos)
+          fn(part, leaf->key(pos), leaf->value(pos));
+        page_id = leaf->rht_ptr();
+      }
+    } catch(...) {
+      errors[part] = std::current_exception();
+    }
+    std::lock_guard<std::mutex> lock(latch);
+    visitor.drop();
+  };
+  vector<std::thread> workers;
+  workers.reserve(parts);
+  for(size_t part = 1; part < parts; ++part)
+    workers.emplace_back(walk, part);
+  walk(0);
+  for(auto &worker : workers)
+    worker.join();
+  for(auto &error : errors)
+    if(error)
+      std::rethrow_exception(error);
+  return parts;
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+typename MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::snapshot&
+MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::snapshot::operator=(snapshot &&other) noexcept {
+  if(this == &other)
+    return *this;
+  release();
+  tree_ = other.tree_;
+  epoch_ = other.epoch_;
+  root_ptr_ = other.root_ptr_;
+  other.tree_ = nullptr;
+  return *this;
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+void MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::snapshot::release() {
+  if(tree_ == nullptr)
+    return;
+  tree_->buf_pool_.close_snapshot(epoch_);
+  tree_ = nullptr;
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+template <class Func>
+void MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::snapshot::walk(
+  const KeyT &lo, const KeyT &hi, Func &&fn) const {
+  if(tree_ == nullptr)
+    throw invalid_iterator("invalid multi-bpt snapshot");
+  if(root_ptr_ == NULL_PAGE_ID)
+    return;
+  auto &buf_pool = tree_->buf_pool_;
+  Visitor holder;
+  auto node = buf_pool.template snapshot_as<Base>(root_ptr_, epoch_, holder);
+  while(!node->is_leaf()) {
+    auto internal = static_cast<const Internal*>(node);
+    node = buf_pool.template snapshot_as<Base>(
+      internal->child(internal->locate_key(lo, tree_->key_compare_)), epoch_, holder);
+  }
+  auto leaf = static_cast<const Leaf*>(node);
+  for(int pos = leaf->locate_key(lo, tree_->key_compare_); ; pos = 0) {
+    for(; pos < leaf->size(); ++pos) {
+      if(tree_->key_compare_(hi, leaf->key(pos)) || !fn(leaf->key(pos), leaf->value(pos)))
+        return;
+    }
+    if(leaf->rht_ptr() == NULL_PAGE_ID)
+      return;
+    leaf = buf_pool.template snapshot_as<Leaf>(leaf->rht_ptr(), epoch_, holder);
+  }
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+template <class Func>
+void MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::snapshot::for_each_equal(
+  const KeyT &key, Func &&fn) const {
+  walk(key, key, [&](const KeyT &, const ValueT &value) {
+    if constexpr (std::is_same_v<std::invoke_result_t<Func&, const ValueT&>, bool>) {
+      return fn(value);
+    } else {
+      fn(value);
+      return true;
+    }
+  });
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+template <class Pred, class Visit>
+size_t MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::snapshot::scan(
+  const KeyT &lo, const KeyT &hi, Pred &&pred, size_t limit, Visit &&visit) const {
+  size_t matched = 0;
+  if(limit == 0)
+    return matched;
+  walk(lo, hi, [&](const KeyT &key, const ValueT &value) {
+    if(!pred(key, value))
+      return true;
+    visit(key, value);
+    return ++matched < limit;
+  });
+  return matched;
+}
+
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+typename MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::iterator&
+  MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::iterator::operator++() {
   if(!visitor_.is_valid()) throw invalid_iterator();
   ++pos_;
   if(const auto *ptr = visitor_.template as<Leaf>(); pos_ == ptr->size()) {
@@ -241,31 +889,31 @@ typename MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare>::iterator&
   return *this;
 }
 
-template <class KeyT, class ValueT, class KeyCompare, class ValueCompare>
-typename MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare>::iterator
-MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare>::begin() {
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+typename MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::iterator
+MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::begin() {
   if(root_ptr_ == NULL_PAGE_ID)
     return end();
-  Visitor visitor = buf_pool_.visitor(root_ptr_);
+  Visitor visitor = node_visitor(root_ptr_);
   while(!visitor.template as<Base>()->is_leaf()) {
     auto node = visitor.template as<Internal>();
     auto ptr = node->child(0);
-    visitor = buf_pool_.visitor(ptr);
+    visitor = node_visitor(ptr);
   }
   return iterator(&buf_pool_, std::move(visitor), 0);
 }
 
-template <class KeyT, class ValueT, class KeyCompare, class ValueCompare>
-typename MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare>::iterator
-MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare>::find_upper(const KeyT &key) {
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+typename MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::iterator
+MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::find_upper(const KeyT &key) {
   if(root_ptr_ == NULL_PAGE_ID)
     return end();
-  Visitor visitor = buf_pool_.visitor(root_ptr_);
+  Visitor visitor = node_visitor(root_ptr_);
   while(!visitor.template as<Base>()->is_leaf()) {
     auto node = visitor.template as<Internal>();
     auto pos = node->locate_key(key, key_compare_);
     auto ptr = node->child(pos);
-    visitor = buf_pool_.visitor(ptr);
+    visitor = node_visitor(ptr);
   }
   auto node = visitor.template as<Leaf>();
   auto pos = node->locate_key(key, key_compare_);
@@ -278,17 +926,17 @@ MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare>::find_upper(const KeyT &k
   return iterator(&buf_pool_, std::move(visitor), pos);
 }
 
-template <class KeyT, class ValueT, class KeyCompare, class ValueCompare>
-typename MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare>::iterator
-MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare>::find(const KeyT &key, const ValueT &value) {
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+typename MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::iterator
+MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::find(const KeyT &key, const ValueT &value) {
   if(root_ptr_ == NULL_PAGE_ID)
     return end();
-  Visitor visitor = buf_pool_.visitor(root_ptr_);
+  Visitor visitor = node_visitor(root_ptr_);
   while(!visitor.template as<Base>()->is_leaf()) {
     auto node = visitor.template as<Internal>();
     auto pos = node->locate_pair(key, value, kv_compare_);
     auto ptr = node->child(pos);
-    visitor = buf_pool_.visitor(ptr);
+    visitor = node_visitor(ptr);
   }
   auto node = visitor.template as<Leaf>();
   auto pos = node->locate_pair(key, value, kv_compare_);
@@ -304,7 +952,39 @@ MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare>::find(const KeyT &key, co
   return iterator(&buf_pool_, std::move(visitor), pos);
 }
 
+template <class KeyT, class ValueT, class KeyCompare, class ValueCompare, class LeafT>
+typename MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::iterator
+MultiBplustree<KeyT, ValueT, KeyCompare, ValueCompare, LeafT>::find_nth(const KeyT &key, size_t rank) {
+  if(root_ptr_ == NULL_PAGE_ID)
+    return end();
+  // the index of the first entry not lower than key, then the one rank after it.
+  size_t index = 0;
+  Visitor visitor = node_visitor(root_ptr_);
+  while(!visitor.template as<Base>()->is_leaf()) {
+    auto node = visitor.template as<Internal>();
+    auto pos = node->locate_key(key, key_compare_);
+    for(int i = 0; i < pos; ++i)
+      index += node->count(i);
+    visitor = node_visitor(node->child(pos));
+  }
+  index += visitor.template as<Leaf>()->locate_key(key, key_compare_) + rank;
+
+  visitor = node_visitor(root_ptr_);
+  while(!visitor.template as<Base>()->is_leaf()) {
+    auto node = visitor.template as<Internal>();
+    int pos = 0;
+    while(pos + 1 < node->size() && index >= node->count(pos))
+      index -= node->count(pos++);
+    visitor = node_visitor(node->child(pos));
+  }
+  if(index >= static_cast<size_t>(visitor.template as<Leaf>()->size()))
+    return end();
+  iterator it(&buf_pool_, std::move(visitor), static_cast<int>(index));
+  if(key_compare_(key, it.view().first))
+    return end();
+  return it;
+}
 
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,58 @@
+#ifndef INSOMNIA_OVERFLOW_BPLUSTREE_TCC
+#define INSOMNIA_OVERFLOW_BPLUSTREE_TCC
+
+#include "overflow_bplustree.h"
+
+namespace insomnia {
+
+template <class KeyT, class ValueT, class KeyCompare>
+OverflowBplustree<KeyT, ValueT, KeyCompare>::OverflowBplustree(
+  const std::filesystem::path &path, int buffer_capacity, int replacer_k_arg)
+    : index_(path.string() + "-ovf", buffer_capacity, replacer_k_arg),
+      heap_(path.string() + "-heap", buffer_capacity, replacer_k_arg) {}
+
+template <class KeyT, class ValueT, class KeyCompare>
+OverflowBplustree<KeyT, ValueT, KeyCompare>::OverflowBplustree(
+  const std::filesystem::path &path, int buffer_capacity, int replacer_k_arg, size_t filter_bits_per_key)
+  requires std::is_constructible_v<IndexTree, const std::filesystem::path&, int, int, size_t>
+    : index_(path.string() + "-ovf", buffer_capacity, replacer_k_arg, filter_bits_per_key),
+      heap_(path.string() + "-heap", buffer_capacity, replacer_k_arg) {}
+
+template <class KeyT, class ValueT, class KeyCompare>
+optional<ValueT> OverflowBplustree<KeyT, ValueT, KeyCompare>::search(const KeyT &key) {
+  auto it = find(key);
+  if(it == end())
+    return optional<ValueT>();
+  return make_optional<ValueT>(it.view().second);
+}
+
+template <class KeyT, class ValueT, class KeyCompare>
+bool OverflowBplustree<KeyT, ValueT, KeyCompare>::insert(const KeyT &key, const ValueT &value) {
+  if(index_.find(key) != index_.end())
+    return false;
+  auto value_ptr = heap_.alloc();
+  {
+    auto visitor = heap_.visitor(value_ptr);
+    *visitor.template as_mut<ValueT>() = value;
+  }
+  index_.insert(key, value_ptr);
+  return true;
+}
+
+template <class KeyT, class ValueT, class KeyCompare>
+bool OverflowBplustree<KeyT, ValueT, KeyCompare>::remove(const KeyT &key) {
+  page_id_t value_ptr;
+  {
+    auto it = index_.find(key);
+    if(it == index_.end())
+      return false;
+    value_ptr = it.view().second;
+  }
+  index_.remove(key);
+  heap_.dealloc(value_ptr);
+  return true;
+}
+
+}
+
+#endif
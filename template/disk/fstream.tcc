@@ -5,8 +5,8 @@
 
 namespace insomnia {
 
-template <class T, class Meta> requires FstreamConcept<T, Meta>
-fstream<T, Meta>::fstream(const std::filesystem::path &path)
+template <class T, class Meta, size_t page_size> requires FstreamConcept<T, Meta, page_size>
+fstream<T, Meta, page_size>::fstream(const std::filesystem::path &path)
     : path_(path), index_allocator_(path.string() + ".idx") {
   bool file_exists = std::filesystem::exists(path);
   auto open_mode = std::ios::binary | std::ios::in | std::ios::out;
@@ -18,14 +18,14 @@ fstream<T, Meta>::fstream(const std::filesystem::path &path)
   file_size_ = std::filesystem::file_size(path);
 }
 
-template <class T, class Meta> requires FstreamConcept<T, Meta>
-fstream<T, Meta>::~fstream() {
+template <class T, class Meta, size_t page_size> requires FstreamConcept<T, Meta, page_size>
+fstream<T, Meta, page_size>::~fstream() {
   if(fstream_.is_open())
     fstream_.close();
 }
 
-template <class T, class Meta> requires FstreamConcept<T, Meta>
-bool fstream<T, Meta>::read(page_id_t pos, T *data) {
+template <class T, class Meta, size_t page_size> requires FstreamConcept<T, Meta, page_size>
+bool fstream<T, Meta, page_size>::read(page_id_t pos, T *data) {
   if(pos <= NULL_PAGE_ID)
     throw invalid_page(std::string("Accessing invalid page. Correlated file: " + path_.string()).c_str());
   size_t offset = SIZE_META + (pos - NULL_PAGE_ID - 1) * SIZE_T;
@@ -37,8 +37,8 @@ bool fstream<T, Meta>::read(page_id_t pos, T *data) {
   return true;
 }
 
-template <class T, class Meta> requires FstreamConcept<T, Meta>
-void fstream<T, Meta>::write(page_id_t pos, const T *data) {
+template <class T, class Meta, size_t page_size> requires FstreamConcept<T, Meta, page_size>
+void fstream<T, Meta, page_size>::write(page_id_t pos, const T *data) {
   if(pos <= NULL_PAGE_ID)
     throw invalid_page(std::string("Accessing invalid page. Correlated file: " + path_.string()).c_str());
   size_t offset = SIZE_META + (pos - NULL_PAGE_ID - 1) * SIZE_T;
@@ -47,10 +47,11 @@ void fstream<T, Meta>::write(page_id_t pos, const T *data) {
     reserve(required_size + (pos - NULL_PAGE_ID - 1) * SIZE_T);
   fstream_.seekp(offset);
   fstream_.write(reinterpret_cast<const char*>(data), SIZE_T);
+  ++write_cnt_;
 }
 
-template <class T, class Meta> requires FstreamConcept<T, Meta>
-bool fstream<T, Meta>::read_meta(Meta *data) requires (!EmptyMeta<Meta>) {
+template <class T, class Meta, size_t page_size> requires FstreamConcept<T, Meta, page_size>
+bool fstream<T, Meta, page_size>::read_meta(Meta *data) requires (!EmptyMeta<Meta>) {
   size_t required_size = SIZE_META;
   if(required_size > file_size_)
     return false;
@@ -59,17 +60,17 @@ bool fstream<T, Meta>::read_meta(Meta *data) requires (!EmptyMeta<Meta>) {
   return true;
 }
 
-template <class T, class Meta> requires FstreamConcept<T, Meta>
-void fstream<T, Meta>::write_meta(const Meta *data) requires (!EmptyMeta<Meta>) {
+template <class T, class Meta, size_t page_size> requires FstreamConcept<T, Meta, page_size>
+void fstream<T, Meta, page_size>::write_meta(const Meta *data) requires (!EmptyMeta<Meta>) {
   size_t required_size = SIZE_META;
   if(required_size > file_size_)
     reserve(required_size);
   fstream_.seekp(0);
-  fstream_.write(reinterpret_cast<const char*>(data), SIZE_META);
+  fstream_.write(reinterpret_cast<const char*>(data), sizeof(Meta));
 }
 
-template <class T, class Meta> requires FstreamConcept<T, Meta>
-void fstream<T, Meta>::reserve(size_t required_size) {
+template <class T, class Meta, size_t page_size> requires FstreamConcept<T, Meta, page_size>
+void fstream<T, Meta, page_size>::reserve(size_t required_size) {
   if(required_size <= file_size_)
     return;
   fstream_.close();
@@ -85,8 +86,20 @@ void fstream<T, Meta>::reserve(size_t required_size) {
   file_size_ = required_size;
 }
 
-template <class T, class Meta> requires FstreamConcept<T, Meta>
-void fstream<T, Meta>::clear() {
+template <class T, class Meta, size_t page_size> requires FstreamConcept<T, Meta, page_size>
+void fstream<T, Meta, page_size>::truncate(page_id_t max_page_id) {
+  index_allocator_.truncate(max_page_id);
+  size_t required_size = SIZE_META + (max_page_id - NULL_PAGE_ID) * SIZE_T;
+  if(required_size >= file_size_)
+    return;
+  fstream_.close();
+  std::filesystem::resize_file(path_, required_size);
+  fstream_.open(path_, std::ios::binary | std::ios::in | std::ios::out);
+  file_size_ = required_size;
+}
+
+template <class T, class Meta, size_t page_size> requires FstreamConcept<T, Meta, page_size>
+void fstream<T, Meta, page_size>::clear() {
   index_allocator_.clear();
   fstream_.close();
   std::filesystem::resize_file(path_, 0);
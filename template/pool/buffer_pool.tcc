@@ -7,8 +7,9 @@ namespace insomnia {
 
 /********* BufferPool **********/
 
-template <class T, class Meta, size_t max_size> requires (max_size >= sizeof(T))
-BufferPool<T, Meta, max_size>::BufferPool(const std::filesystem::path &path, frame_id_t frame_cnt, int replacer_k_arg)
+template <class T, class Meta, size_t max_size, size_t page_size>
+  requires (max_size >= sizeof(T) && ValidPageSize<page_size>)
+BufferPool<T, Meta, max_size, page_size>::BufferPool(const std::filesystem::path &path, frame_id_t frame_cnt, int replacer_k_arg)
     : path_(path), frame_count_(frame_cnt), replacer_(frame_count_, replacer_k_arg),
       fs_(path.string() + ".dat") {
   frames_.reserve(frame_cnt);
@@ -19,26 +20,31 @@ BufferPool<T, Meta, max_size>::BufferPool(const std::filesystem::path &path, fra
   }
 }
 
-template <class T, class Meta, size_t max_size> requires (max_size >= sizeof(T))
-BufferPool<T, Meta, max_size>::Visitor::Visitor(Frame *frame, fstream_t *fs, LruKReplacer *replacer)
-: frame_(frame), fs_(fs), replacer_(replacer) {
+template <class T, class Meta, size_t max_size, size_t page_size>
+  requires (max_size >= sizeof(T) && ValidPageSize<page_size>)
+BufferPool<T, Meta, max_size, page_size>::Visitor::Visitor(
+  Frame *frame, fstream_t *fs, LruKReplacer *replacer, BufferPool *pool)
+: frame_(frame), fs_(fs), replacer_(replacer), pool_(pool) {
   replacer->access(frame->frame_id);
   if(frame->pin_count == 0)
     replacer->pin(frame->frame_id);
   ++frame->pin_count;
 }
 
-template <class T, class Meta, size_t max_size> requires (max_size >= sizeof(T))
-BufferPool<T, Meta, max_size>::Visitor::Visitor(Visitor &&other)
-: frame_(other.frame_), fs_(other.fs_), replacer_(other.replacer_) {
+template <class T, class Meta, size_t max_size, size_t page_size>
+  requires (max_size >= sizeof(T) && ValidPageSize<page_size>)
+BufferPool<T, Meta, max_size, page_size>::Visitor::Visitor(Visitor &&other)
+: frame_(other.frame_), fs_(other.fs_), replacer_(other.replacer_), pool_(other.pool_) {
   other.frame_ = nullptr;
   other.fs_ = nullptr;
   other.replacer_ = nullptr;
+  other.pool_ = nullptr;
 }
 
-template <class T, class Meta, size_t max_size> requires (max_size >= sizeof(T))
-typename BufferPool<T, Meta, max_size>::Visitor&
-  BufferPool<T, Meta, max_size>::Visitor::operator=(Visitor &&other) noexcept {
+template <class T, class Meta, size_t max_size, size_t page_size>
+  requires (max_size >= sizeof(T) && ValidPageSize<page_size>)
+typename BufferPool<T, Meta, max_size, page_size>::Visitor&
+  BufferPool<T, Meta, max_size, page_size>::Visitor::operator=(Visitor &&other) noexcept {
 
   if(this == &other)
     return *this;
@@ -46,11 +52,13 @@ typename BufferPool<T, Meta, max_size>::Visitor&
   frame_ = other.frame_;       other.frame_ = nullptr;
   fs_ = other.fs_;             other.fs_ = nullptr;
   replacer_ = other.replacer_; other.replacer_ = nullptr;
+  pool_ = other.pool_;         other.pool_ = nullptr;
   return *this;
 }
 
-template <class T, class Meta, size_t max_size> requires (max_size >= sizeof(T))
-void BufferPool<T, Meta, max_size>::Visitor::flush() {
+template <class T, class Meta, size_t max_size, size_t page_size>
+  requires (max_size >= sizeof(T) && ValidPageSize<page_size>)
+void BufferPool<T, Meta, max_size, page_size>::Visitor::flush() {
   if(frame_ == nullptr)
     throw invalid_page("Buffer pool error: Flushing invalid visitor.");
   if(frame_->is_dirty) {
@@ -59,8 +67,9 @@ void BufferPool<T, Meta, max_size>::Visitor::flush() {
   }
 }
 
-template <class T, class Meta, size_t max_size> requires (max_size >= sizeof(T))
-void BufferPool<T, Meta, max_size>::Visitor::drop() {
+template <class T, class Meta, size_t max_size, size_t page_size>
+  requires (max_size >= sizeof(T) && ValidPageSize<page_size>)
+void BufferPool<T, Meta, max_size, page_size>::Visitor::drop() {
   if(frame_ == nullptr)
     return;
   --frame_->pin_count;
@@ -69,45 +78,69 @@ void BufferPool<T, Meta, max_size>::Visitor::drop() {
   frame_ = nullptr;
   fs_ = nullptr;
   replacer_ = nullptr;
+  pool_ = nullptr;
 }
 
-template <class T, class Meta, size_t max_size> requires (max_size >= sizeof(T))
+template <class T, class Meta, size_t max_size, size_t page_size>
+  requires (max_size >= sizeof(T) && ValidPageSize<page_size>)
+typename BufferPool<T, Meta, max_size, page_size>::Visitor BufferPool<T, Meta, max_size, page_size>::Visitor::share() const {
+  if(frame_ == nullptr)
+    throw invalid_page("Buffer pool error: Sharing invalid visitor");
+  Visitor visitor;
+  visitor.frame_ = frame_;
+  visitor.fs_ = fs_;
+  visitor.replacer_ = replacer_;
+  visitor.pool_ = pool_;
+  ++frame_->pin_count;
+  return visitor;
+}
+
+template <class T, class Meta, size_t max_size, size_t page_size>
+  requires (max_size >= sizeof(T) && ValidPageSize<page_size>)
 template <class Derived> requires (std::derived_from<Derived, T> && (max_size >= sizeof(Derived)))
-const Derived* BufferPool<T, Meta, max_size>::Visitor::as() const {
+const Derived* BufferPool<T, Meta, max_size, page_size>::Visitor::as() const {
   if(frame_ == nullptr)
     throw invalid_page("Buffer pool error: Using invalid visitor");
   return reinterpret_cast<const Derived*>(frame_->data());
 }
 
-template <class T, class Meta, size_t max_size> requires (max_size >= sizeof(T))
+template <class T, class Meta, size_t max_size, size_t page_size>
+  requires (max_size >= sizeof(T) && ValidPageSize<page_size>)
 template <class Derived> requires (std::derived_from<Derived, T> && (max_size >= sizeof(Derived)))
-Derived* BufferPool<T, Meta, max_size>::Visitor::as_mut() {
+Derived* BufferPool<T, Meta, max_size, page_size>::Visitor::as_mut() {
   if(frame_ == nullptr)
     throw invalid_page("Buffer pool error: Using invalid visitor");
+  if(!pool_->snapshots_.empty())
+    pool_->keep_before_image(*frame_);
   frame_->is_dirty = true;
   return reinterpret_cast<Derived*>(frame_->data());
 }
 
-template <class T, class Meta, size_t max_size> requires (max_size >= sizeof(T))
-void BufferPool<T, Meta, max_size>::write_meta(const Meta *meta) requires (!EmptyMeta<Meta>) {
+template <class T, class Meta, size_t max_size, size_t page_size>
+  requires (max_size >= sizeof(T) && ValidPageSize<page_size>)
+void BufferPool<T, Meta, max_size, page_size>::write_meta(const Meta *meta) requires (!EmptyMeta<Meta>) {
   memcpy(meta_wrapper_.data(), meta, sizeof(Meta));
   fs_.write_meta(&meta_wrapper_);
 }
 
-template <class T, class Meta, size_t max_size> requires (max_size >= sizeof(T))
-bool BufferPool<T, Meta, max_size>::read_meta(Meta *meta) requires (!EmptyMeta<Meta>) {
+template <class T, class Meta, size_t max_size, size_t page_size>
+  requires (max_size >= sizeof(T) && ValidPageSize<page_size>)
+bool BufferPool<T, Meta, max_size, page_size>::read_meta(Meta *meta) requires (!EmptyMeta<Meta>) {
   if(!fs_.read_meta(&meta_wrapper_))
     return false;
   memcpy(meta, meta_wrapper_.data(), sizeof(Meta));
   return true;
 }
 
-template <class T, class Meta, size_t max_size> requires (max_size >= sizeof(T))
-void BufferPool<T, Meta, max_size>::dealloc(page_id_t page_id) {
+template <class T, class Meta, size_t max_size, size_t page_size>
+  requires (max_size >= sizeof(T) && ValidPageSize<page_size>)
+void BufferPool<T, Meta, max_size, page_size>::dealloc(page_id_t page_id) {
   if(auto it = usage_map_.find(page_id); it != usage_map_.end()) {
     frame_id_t frame_id = it->second;
     if(frames_[frame_id].pin_count > 0)
       throw pool_exception("Buffer pool error : Freeing pages in use.");
+    if(!snapshots_.empty())
+      keep_before_image(frames_[frame_id]);
     frames_[frame_id].is_valid = false;
     free_frames_.push_back(frame_id);
     usage_map_.erase(it);
@@ -115,14 +148,33 @@ void BufferPool<T, Meta, max_size>::dealloc(page_id_t page_id) {
   fs_.dealloc(page_id);
 }
 
-template <class T, class Meta, size_t max_size> requires (max_size >= sizeof(T))
-typename BufferPool<T, Meta, max_size>::Visitor
-BufferPool<T, Meta, max_size>::visitor(page_id_t page_id) {
+template <class T, class Meta, size_t max_size, size_t page_size>
+  requires (max_size >= sizeof(T) && ValidPageSize<page_size>)
+void BufferPool<T, Meta, max_size, page_size>::truncate(page_id_t max_page_id) {
+  if(!snapshots_.empty())
+    throw pool_exception("Buffer pool error : Truncating under open snapshots.");
+  for(auto &frame : frames_) {
+    if(!frame.is_valid || frame.page_id <= max_page_id)
+      continue;
+    if(frame.pin_count > 0)
+      throw pool_exception("Buffer pool error : Truncating pages in use.");
+    frame.is_valid = false;
+    frame.is_dirty = false;
+    free_frames_.push_back(frame.frame_id);
+    usage_map_.erase(frame.page_id);
+  }
+  fs_.truncate(max_page_id);
+}
+
+template <class T, class Meta, size_t max_size, size_t page_size>
+  requires (max_size >= sizeof(T) && ValidPageSize<page_size>)
+typename BufferPool<T, Meta, max_size, page_size>::Visitor
+BufferPool<T, Meta, max_size, page_size>::visitor(page_id_t page_id) {
   // return DefaultVisitor(page_id, &fs_);
   frame_id_t frame_id;
   if(auto it = usage_map_.find(page_id); it != usage_map_.end()) {
     frame_id = it->second;
-    return Visitor(&frames_[frame_id], &fs_, &replacer_);
+    return Visitor(&frames_[frame_id], &fs_, &replacer_, this);
   }
   if(!free_frames_.empty()) {
     frame_id = free_frames_.back();
@@ -139,14 +191,18 @@ BufferPool<T, Meta, max_size>::visitor(page_id_t page_id) {
     usage_map_.erase(frames_[frame_id].page_id);
   }
   frames_[frame_id].page_id = page_id;
+  frames_[frame_id].image_epoch = 0;
   usage_map_.emplace(page_id, frame_id);
-  fs_.read(page_id, &frames_[frame_id].data_wrapper);
-  return Visitor(&frames_[frame_id], &fs_, &replacer_);
+  // a page never written back reads as zeros.
+  if(!fs_.read(page_id, &frames_[frame_id].data_wrapper))
+    memset(frames_[frame_id].data(), 0, sizeof(frames_[frame_id].data_wrapper));
+  return Visitor(&frames_[frame_id], &fs_, &replacer_, this);
 }
 
 /*
-template <class T, class Meta, size_t max_size> requires (max_size >= sizeof(T))
-void BufferPool<T, Meta, max_size>::flush_page(page_id_t page_id) {
+template <class T, class Meta, size_t max_size, size_t page_size>
+  requires (max_size >= sizeof(T) && ValidPageSize<page_size>)
+void BufferPool<T, Meta, max_size, page_size>::flush_page(page_id_t page_id) {
   if(auto it = usage_map_.find(page_id); it != usage_map_.end()) {
     frame_id_t frame_id = it->second;
     flush_frame(frames_[frame_id]);
@@ -154,16 +210,22 @@ void BufferPool<T, Meta, max_size>::flush_page(page_id_t page_id) {
 }
 */
 
-template <class T, class Meta, size_t max_size> requires (max_size >= sizeof(T))
-void BufferPool<T, Meta, max_size>::flush_all() {
+template <class T, class Meta, size_t max_size, size_t page_size>
+  requires (max_size >= sizeof(T) && ValidPageSize<page_size>)
+void BufferPool<T, Meta, max_size, page_size>::flush_all() {
   // since no concurrency involved, even a pinned frame can be flushed.
   for(frame_id_t i = 0; i < frame_count_; ++i)
     if(frames_[i].is_valid)
       flush_frame(frames_[i]);
 }
 
-template <class T, class Meta, size_t max_size> requires (max_size >= sizeof(T))
-void BufferPool<T, Meta, max_size>::clear() {
+template <class T, class Meta, size_t max_size, size_t page_size>
+  requires (max_size >= sizeof(T) && ValidPageSize<page_size>)
+void BufferPool<T, Meta, max_size, page_size>::clear() {
+  if(!snapshots_.empty())
+    throw pool_exception("Buffer pool error : Clearing under open snapshots.");
+  images_.clear();
+  image_cnt_ = 0;
   fs_.clear();
   usage_map_.clear();
   frames_.clear();
@@ -175,8 +237,9 @@ void BufferPool<T, Meta, max_size>::clear() {
   replacer_.clear();
 }
 
-template <class T, class Meta, size_t max_size> requires (max_size >= sizeof(T))
-void BufferPool<T, Meta, max_size>::flush_frame(Frame &frame) {
+template <class T, class Meta, size_t max_size, size_t page_size>
+  requires (max_size >= sizeof(T) && ValidPageSize<page_size>)
+void BufferPool<T, Meta, max_size, page_size>::flush_frame(Frame &frame) {
   if(!frame.is_valid)
     throw invalid_page("Buffer pool error: Flushing invalid frame.");
   if(frame.is_dirty) {
@@ -185,6 +248,92 @@ void BufferPool<T, Meta, max_size>::flush_frame(Frame &frame) {
   }
 }
 
+template <class T, class Meta, size_t max_size, size_t page_size>
+  requires (max_size >= sizeof(T) && ValidPageSize<page_size>)
+epoch_t BufferPool<T, Meta, max_size, page_size>::open_snapshot() {
+  snapshots_.push_back(epoch_);
+  return epoch_++;
+}
+
+template <class T, class Meta, size_t max_size, size_t page_size>
+  requires (max_size >= sizeof(T) && ValidPageSize<page_size>)
+void BufferPool<T, Meta, max_size, page_size>::close_snapshot(epoch_t epoch) {
+  size_t pos = 0;
+  while(pos < snapshots_.size() && snapshots_[pos] != epoch)
+    ++pos;
+  if(pos == snapshots_.size())
+    throw pool_exception("Buffer pool error : Closing unknown snapshot.");
+  snapshots_.erase(pos);
+  if(snapshots_.empty()) {
+    images_.clear();
+    image_cnt_ = 0;
+    return;
+  }
+  // an image taken in epoch w is read by the snapshots in [w', w), w' being the epoch of the
+  // image before it. The ones no open snapshot falls in go.
+  vector<page_id_t> emptied;
+  for(auto it = images_.begin(); it != images_.end(); ++it) {
+    auto &chain = it->second;
+    vector<BeforeImage> kept;
+    epoch_t prev = 0;
+    for(auto &image : chain) {
+      bool needed = false;
+      for(auto snapshot : snapshots_)
+        if(prev <= snapshot && snapshot < image.epoch) {
+          needed = true;
+          break;
+        }
+      prev = image.epoch;
+      if(needed)
+        kept.push_back(std::move(image));
+      else
+        --image_cnt_;
+    }
+    if(kept.empty())
+      emptied.push_back(it->first);
+    chain = std::move(kept);
+  }
+  for(auto page_id : emptied)
+    images_.erase(page_id);
+}
+
+template <class T, class Meta, size_t max_size, size_t page_size>
+  requires (max_size >= sizeof(T) && ValidPageSize<page_size>)
+template <class Derived> requires (std::derived_from<Derived, T> && (max_size >= sizeof(Derived)))
+const Derived* BufferPool<T, Meta, max_size, page_size>::snapshot_as(
+  page_id_t page_id, epoch_t epoch, Visitor &holder) {
+  if(!images_.empty()) {
+    if(auto it = images_.find(page_id); it != images_.end()) {
+      for(auto &image : it->second)
+        if(image.epoch > epoch) {
+          holder.drop();
+          return reinterpret_cast<const Derived*>(image.data.data());
+        }
+    }
+  }
+  holder = visitor(page_id);
+  return holder.template as<Derived>();
+}
+
+template <class T, class Meta, size_t max_size, size_t page_size>
+  requires (max_size >= sizeof(T) && ValidPageSize<page_size>)
+void BufferPool<T, Meta, max_size, page_size>::keep_before_image(Frame &frame) {
+  if(frame.image_epoch == epoch_)
+    return;
+  frame.image_epoch = epoch_;
+  auto &chain = images_[frame.page_id];
+  if(!chain.empty() && chain.back().epoch == epoch_)
+    return;
+  // nothing was written to the page since the last snapshot opened: no one needs the image.
+  if(!chain.empty() && chain.back().epoch > snapshots_.back())
+    return;
+  BeforeImage image{epoch_, vector<char>()};
+  image.data.resize(frame.data_wrapper.size());
+  memcpy(image.data.data(), frame.data(), frame.data_wrapper.size());
+  chain.push_back(std::move(image));
+  ++image_cnt_;
+}
+
 
 /**** CompressedBufferPool ****/
 
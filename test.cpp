@@ -0,0 +1,977 @@
+#include <iostream>
+#include <filesystem>
+#include <random>
+#include <set>
+#include <vector>
+#include <memory>
+#include <climits>
+#include <string>
+#include <stdexcept>
+#include <map>
+#include <unordered_map>
+
+#include "bplustree.h"
+#include "overflow_bplustree.h"
+#include "multi_bplustree.h"
+#include "buffered_multi_bplustree.h"
+#include "extendible_hash.h"
+#include "range_kernels.h"
+#include "ts_types.h"
+#include "train_manager.h"
+
+// Randomized tests of the B+ trees against std::map<key, value> and, for the multi trees,
+// std::set<(key, value)>: inserts, removals, range removals, compaction steps and reopening,
+// with the whole content, the lookups and the rank lookups compared now and then.
+// Run with no argument for all seeds, or with a seed to run only that one.
+
+namespace ism = insomnia;
+namespace fs = std::filesystem;
+
+// a value large enough for a small fanout, so that the trees get a few levels.
+struct Record {
+  int id;
+  char payload[200];
+
+  Record() : id(0), payload() {}
+  explicit Record(int _id) : id(_id), payload() { payload[id % 200] = static_cast<char>(id); }
+  bool operator<(const Record &other) const { return id < other.id; }
+  bool operator==(const Record &other) const { return id == other.id; }
+};
+
+using Key = uint64_t;
+using Model = std::set<std::pair<Key, int>>;
+using SingleModel = std::map<Key, int>;
+
+struct TestConfig {
+  int op_cnt;
+  int key_cnt;       // distinct keys; few of them make long runs of duplicates
+  bool spread_keys;  // keys differing in their high bytes, for the prefix leaves
+};
+
+class TestFailure : public std::runtime_error {
+public:
+  using std::runtime_error::runtime_error;
+};
+
+#define CHECK(cond, what) \
+  do { if(!(cond)) throw TestFailure(std::string(what) + " (line " + std::to_string(__LINE__) + ")"); } while(0)
+
+template <class Tree>
+void check_content(Tree &tree, const Model &model, std::mt19937 &rng, const TestConfig &config,
+                   const ism::vector<Key> &keys) {
+  auto it = tree.begin();
+  for(const auto &[key, id] : model) {
+    CHECK(it.is_valid(), "iteration ends early");
+    auto entry = it.view();
+    CHECK(entry.first == key && entry.second.id == id, "iteration order");
+    ++it;
+  }
+  CHECK(!it.is_valid(), "iteration runs past the end");
+
+  for(int probe = 0; probe < 8; ++probe) {
+    auto key = keys[rng() % config.key_cnt];
+    auto lo = model.lower_bound({key, INT_MIN}), hi = model.lower_bound({key + 1, INT_MIN});
+    ism::vector<int> expected;
+    for(auto cur = lo; cur != hi; ++cur)
+      expected.push_back(cur->second);
+    auto found = tree.search(key);
+    CHECK(found.size() == expected.size(), "search count");
+    for(size_t i = 0; i < found.size(); ++i)
+      CHECK(found[i].id == expected[i], "search values");
+    size_t walked = 0;
+    tree.for_each_equal(key, [&](const Record &value) {
+      CHECK(walked < expected.size() && value.id == expected[walked], "for_each_equal values");
+      ++walked;
+    });
+    CHECK(walked == expected.size(), "for_each_equal count");
+    size_t rank = expected.empty() ? 0 : rng() % (expected.size() + 1);
+    auto nth = tree.find_nth(key, rank);
+    if(rank < expected.size()) {
+      CHECK(nth.is_valid(), "find_nth misses");
+      CHECK(nth.view().first == key && nth.view().second.id == expected[rank], "find_nth value");
+    } else {
+      CHECK(!nth.is_valid(), "find_nth past the end");
+    }
+  }
+}
+
+ism::vector<Key> make_keys(const TestConfig &config) {
+  ism::vector<Key> keys;
+  for(int i = 0; i < config.key_cnt; ++i)
+    keys.push_back(config.spread_keys ? (static_cast<Key>(i) * 0x9E3779B97F4A7C15ull) : static_cast<Key>(i));
+  return keys;
+}
+
+fs::path make_test_dir(unsigned seed) {
+  auto dir = fs::temp_directory_path() / ("ism_test_" + std::to_string(seed));
+  fs::remove_all(dir);
+  fs::create_directory(dir);
+  return dir;
+}
+
+// the buffered trees get a small message buffer, so that it is applied every few dozen updates.
+template <class Tree>
+std::unique_ptr<Tree> open_tree(const fs::path &path) {
+  if constexpr(requires { Tree(path, 32, 2, 61); })
+    return std::make_unique<Tree>(path, 32, 2, 61);
+  else
+    return std::make_unique<Tree>(path, 32, 2);
+}
+
+template <class Tree>
+void run_one(const char *name, unsigned seed, const TestConfig &config) {
+  auto dir = make_test_dir(seed);
+  auto path = dir / "tree";
+  std::mt19937 rng(seed);
+  auto keys = make_keys(config);
+  ism::vector<Key> sorted_keys(keys);
+  ism::sort(sorted_keys.begin(), sorted_keys.end());
+
+  Model model;
+  int op = 0;
+  try {
+    auto tree = open_tree<Tree>(path);
+    for(; op < config.op_cnt; ++op) {
+      // phases of growth and shrinkage, so that nodes fill up, empty out and merge.
+      auto dice = rng() % 1000;
+      if(dice < (op / 4000 % 2 == 0 ? 760 : 360)) {
+        auto key = keys[rng() % config.key_cnt];
+        int id = rng() % 1000;
+        tree->insert(key, Record(id));
+        model.insert({key, id});
+      } else if(dice < 900) {
+        if(model.empty())
+          continue;
+        // mostly a stored pair, sometimes an absent one.
+        Key key;
+        int id;
+        if(rng() % 8) {
+          auto cur = model.lower_bound({keys[rng() % config.key_cnt], static_cast<int>(rng() % 1000)});
+          if(cur == model.end())
+            cur = model.begin();
+          key = cur->first;
+          id = cur->second;
+        } else {
+          key = keys[rng() % config.key_cnt];
+          id = rng() % 1000;
+        }
+        tree->remove(key, Record(id));
+        model.erase({key, id});
+      } else if(dice < 905) {
+        auto first = rng() % config.key_cnt;
+        auto last = std::min<size_t>(first + rng() % 4, config.key_cnt - 1);
+        auto lo = sorted_keys[first], hi = sorted_keys[last];
+        tree->remove_range(lo, hi);
+        model.erase(model.lower_bound({lo, INT_MIN}), model.upper_bound({hi, INT_MAX}));
+      } else if(dice < 990) {
+        tree->compact_step(1 + rng() % 8);
+      } else if(dice < 992) {
+        tree.reset();
+        tree = open_tree<Tree>(path);
+      } else {
+        check_content(*tree, model, rng, config, keys);
+      }
+    }
+    // finish the running compaction pass, and check that nothing is lost on the way.
+    while(!tree->compact_step(4))
+      ;
+    check_content(*tree, model, rng, config, keys);
+    tree.reset();
+    tree = open_tree<Tree>(path);
+    check_content(*tree, model, rng, config, keys);
+  } catch(const std::exception &e) {
+    fs::remove_all(dir);
+    throw TestFailure(std::string(name) + ", seed " + std::to_string(seed) +
+                      ", op " + std::to_string(op) + ": " + e.what());
+  }
+  fs::remove_all(dir);
+}
+
+template <class Tree>
+void check_single_content(Tree &tree, const SingleModel &model, std::mt19937 &rng, const TestConfig &config,
+                          const ism::vector<Key> &keys) {
+  auto it = tree.begin();
+  for(const auto &[key, id] : model) {
+    CHECK(it.is_valid(), "iteration ends early");
+    auto entry = it.view();
+    CHECK(entry.first == key && entry.second.id == id, "iteration order");
+    ++it;
+  }
+  CHECK(!it.is_valid(), "iteration runs past the end");
+
+  for(int probe = 0; probe < 16; ++probe) {
+    auto key = keys[rng() % config.key_cnt];
+    auto expected = model.find(key);
+    auto found = tree.search(key);
+    CHECK(found.has_value() == (expected != model.end()), "search presence");
+    if(found.has_value())
+      CHECK((*found).id == expected->second, "search value");
+    auto upper = tree.find_upper(key);
+    auto expected_upper = model.lower_bound(key);
+    CHECK(upper.is_valid() == (expected_upper != model.end()), "find_upper presence");
+    if(upper.is_valid())
+      CHECK(upper.view().first == expected_upper->first, "find_upper key");
+  }
+}
+
+// as run_one, for the trees with one value per key.
+template <class Tree>
+void run_single(const char *name, unsigned seed, const TestConfig &config) {
+  auto dir = make_test_dir(seed);
+  auto path = dir / "tree";
+  std::mt19937 rng(seed);
+  auto keys = make_keys(config);
+  ism::vector<Key> sorted_keys(keys);
+  ism::sort(sorted_keys.begin(), sorted_keys.end());
+
+  SingleModel model;
+  int op = 0;
+  try {
+    auto tree = std::make_unique<Tree>(path, 32, 2);
+    for(; op < config.op_cnt; ++op) {
+      auto dice = rng() % 1000;
+      if(dice < (op / 4000 % 2 == 0 ? 760 : 360)) {
+        auto key = keys[rng() % config.key_cnt];
+        int id = rng() % 1000;
+        bool fresh = model.emplace(key, id).second;
+        CHECK(tree->insert(key, Record(id)) == fresh, "insert result");
+      } else if(dice < 900) {
+        // mostly a stored key, sometimes an absent one.
+        auto key = keys[rng() % config.key_cnt];
+        if(rng() % 8 && !model.empty()) {
+          auto cur = model.lower_bound(key);
+          key = (cur == model.end() ? model.begin() : cur)->first;
+        }
+        CHECK(tree->remove(key) == (model.erase(key) == 1), "remove result");
+      } else if(dice < 905) {
+        if constexpr(requires { tree->remove_range(Key(), Key()); }) {
+          // wide enough to free whole leaves between the two cut ones.
+          auto first = rng() % config.key_cnt;
+          auto last = std::min<size_t>(first + rng() % 200, config.key_cnt - 1);
+          auto lo = sorted_keys[first], hi = sorted_keys[last];
+          tree->remove_range(lo, hi);
+          model.erase(model.lower_bound(lo), model.upper_bound(hi));
+        }
+      } else if(dice < 990) {
+        tree->compact_step(1 + rng() % 8);
+      } else if(dice < 992) {
+        tree.reset();
+        tree = std::make_unique<Tree>(path, 32, 2);
+      } else {
+        check_single_content(*tree, model, rng, config, keys);
+      }
+    }
+    while(!tree->compact_step(4))
+      ;
+    check_single_content(*tree, model, rng, config, keys);
+    tree.reset();
+    tree = std::make_unique<Tree>(path, 32, 2);
+    check_single_content(*tree, model, rng, config, keys);
+  } catch(const std::exception &e) {
+    fs::remove_all(dir);
+    throw TestFailure(std::string(name) + ", seed " + std::to_string(seed) +
+                      ", op " + std::to_string(op) + ": " + e.what());
+  }
+  fs::remove_all(dir);
+}
+
+// a pass over a deep tree left in disorder by long runs of insertions and removals, which
+// moves internal nodes whose first key is stale.
+template <class Tree>
+void bulk_compact_one(const char *name, unsigned seed, const TestConfig &config) {
+  auto dir = make_test_dir(seed);
+  auto path = dir / "tree";
+  std::mt19937 rng(seed);
+  auto keys = make_keys(config);
+  SingleModel model;
+  try {
+    auto tree = std::make_unique<Tree>(path, 32, 2);
+    auto fill = [&](int cnt) {
+      for(int i = 0; i < cnt; ++i) {
+        auto key = keys[rng() % config.key_cnt];
+        int id = rng() % 1000;
+        bool fresh = model.emplace(key, id).second;
+        CHECK(tree->insert(key, Record(id)) == fresh, "insert result");
+      }
+    };
+    auto drain = [&](int cnt) {
+      for(int i = 0; i < cnt; ++i) {
+        auto key = keys[rng() % config.key_cnt];
+        CHECK(tree->remove(key) == (model.erase(key) == 1), "remove result");
+      }
+    };
+    fill(6000);
+    drain(4000);
+    tree.reset();
+    tree = std::make_unique<Tree>(path, 32, 2);
+    fill(20000);
+    drain(10000);
+    while(!tree->compact_step(16))
+      ;
+    check_single_content(*tree, model, rng, config, keys);
+    tree.reset();
+    tree = std::make_unique<Tree>(path, 32, 2);
+    check_single_content(*tree, model, rng, config, keys);
+  } catch(const std::exception &e) {
+    fs::remove_all(dir);
+    throw TestFailure(std::string(name) + ", seed " + std::to_string(seed) + ": " + e.what());
+  }
+  fs::remove_all(dir);
+}
+
+template <class Run>
+int run_configs(const char *name, const ism::vector<unsigned> &seeds,
+                std::initializer_list<TestConfig> configs, Run &&run) {
+  int failed = 0;
+  for(auto seed : seeds)
+    for(const auto &config : configs) {
+      try {
+        run(seed, config);
+      } catch(const TestFailure &e) {
+        std::cout << "FAIL " << e.what() << " [keys " << config.key_cnt
+                  << (config.spread_keys ? ", spread" : "") << "]\n";
+        ++failed;
+      }
+    }
+  std::cout << name << ": " << (failed == 0 ? "ok" : std::to_string(failed) + " failed") << "\n";
+  return failed;
+}
+
+template <class Tree>
+int run_seeds(const char *name, const ism::vector<unsigned> &seeds) {
+  return run_configs(name, seeds, {
+    {40000, 40, false},
+    {40000, 40, true},
+    {40000, 3, true},
+    {40000, 400, true},
+  }, [name](unsigned seed, const TestConfig &config) { run_one<Tree>(name, seed, config); });
+}
+
+template <class Tree>
+int run_single_seeds(const char *name, const ism::vector<unsigned> &seeds) {
+  int failed = run_configs(name, seeds, {
+    {20000, 3000, false},
+    {20000, 3000, true},
+    {20000, 300, true},
+  }, [name](unsigned seed, const TestConfig &config) { run_single<Tree>(name, seed, config); });
+  auto bulk_name = std::string(name) + " bulk compaction";
+  failed += run_configs(bulk_name.c_str(), seeds, {
+    {0, 20000, true},
+  }, [&bulk_name](unsigned seed, const TestConfig &config) {
+    bulk_compact_one<Tree>(bulk_name.c_str(), seed, config);
+  });
+  return failed;
+}
+
+// a tree with a Bloom filter, opened as the harness opens the others.
+template <class Tree>
+struct Filtered : Tree {
+  Filtered(const fs::path &path, int buffer_capacity, int replacer_k_arg)
+    : Tree(path, buffer_capacity, replacer_k_arg, 10) {}
+};
+
+// the Bloom filter of a Bplustree is saved and loaded across reopening, rebuilt when its file is
+// gone or was written with other parameters, and never loaded when stale: absent keys may pass
+// it, present ones always do.
+int filter_test(const ism::vector<unsigned> &seeds) {
+  using Tree = ism::Bplustree<Key, Record>;
+  int failed = 0;
+  for(auto seed : seeds) {
+    auto dir = make_test_dir(seed);
+    auto path = dir / "tree";
+    auto filter_path = dir / "tree-bpt_bloom";
+    std::mt19937 rng(seed);
+    constexpr int key_cnt = 20000;
+    auto key_of = [](int i) { return static_cast<Key>(i) * 0x9E3779B97F4A7C15ull; };
+    std::set<int> model;
+    auto fill = [&](Tree &tree, int cnt) {
+      for(int i = 0; i < cnt; ++i) {
+        int id = rng() % key_cnt;
+        if(tree.insert(key_of(id), Record(id)))
+          model.insert(id);
+      }
+    };
+    auto drain = [&](Tree &tree, int cnt) {
+      for(int i = 0; i < cnt; ++i) {
+        int id = rng() % key_cnt;
+        CHECK(tree.remove(key_of(id)) == (model.erase(id) == 1), "remove result");
+      }
+    };
+    auto check = [&](Tree &tree) {
+      for(int id = 0; id < key_cnt; ++id) {
+        auto found = tree.search(key_of(id));
+        CHECK(found.has_value() == model.contains(id), "search presence");
+        CHECK(!found.has_value() || (*found).id == id, "search value");
+        CHECK(tree.remove(key_of(id) + 1) == false, "remove of an absent key");
+      }
+    };
+    try {
+      {
+        Tree tree(path, 32, 2, 10);
+        fill(tree, 6000);
+        drain(tree, 4000);
+        check(tree);
+      }
+      CHECK(fs::exists(filter_path), "filter not saved");
+      {
+        // loaded, then outgrown by the new keys and rebuilt.
+        Tree tree(path, 32, 2, 10);
+        check(tree);
+        fill(tree, 20000);
+        drain(tree, 10000);
+        check(tree);
+        tree.remove_range(key_of(0), key_of(key_cnt / 4));
+        std::erase_if(model, [&](int id) { return key_of(id) <= key_of(key_cnt / 4); });
+        while(!tree.compact_step(16))
+          ;
+        check(tree);
+      }
+      fs::remove(filter_path);
+      {
+        Tree tree(path, 32, 2, 10);
+        check(tree);
+      }
+      {
+        Tree tree(path, 32, 2, 4);
+        check(tree);
+      }
+      {
+        // the saved filter misses the keys inserted without one, so it is dropped.
+        Tree tree(path, 32, 2);
+        CHECK(!fs::exists(filter_path), "filter left while the tree is written without it");
+        fill(tree, 2000);
+      }
+      {
+        Tree tree(path, 32, 2, 4);
+        check(tree);
+      }
+    } catch(const std::exception &e) {
+      std::cout << "FAIL filter, seed " << seed << ": " << e.what() << "\n";
+      ++failed;
+    }
+    fs::remove_all(dir);
+  }
+  std::cout << "filter: " << (failed == 0 ? "ok" : std::to_string(failed) + " failed") << "\n";
+  return failed;
+}
+
+// an OverflowBplustree against std::map: inserts, overwrites through the iterator, removals
+// and reopening, with every value on a heap page of its own that is freed on removal and
+// taken again by the next insertions before the heap file grows.
+int overflow_test(const ism::vector<unsigned> &seeds) {
+  using Tree = ism::OverflowBplustree<Key, Record>;
+  int failed = 0;
+  for(auto seed : seeds) {
+    auto dir = make_test_dir(seed);
+    auto path = dir / "tree";
+    std::mt19937 rng(seed);
+    SingleModel model;
+    try {
+      auto tree = std::make_unique<Tree>(path, 32, 2);
+      auto check = [&]() {
+        auto it = tree->begin();
+        for(const auto &[key, id] : model) {
+          CHECK(it.is_valid() && it.view().first == key && it.view().second.id == id, "content");
+          ++it;
+        }
+        CHECK(!it.is_valid(), "content runs past the end");
+        for(int probe = 0; probe < 64; ++probe) {
+          Key key = rng() % 8000;
+          auto found = tree->search(key);
+          CHECK(found.has_value() == model.contains(key), "search presence");
+          CHECK(!found.has_value() || (*found).id == model[key], "search value");
+        }
+        // one heap page per stored value, the others free.
+        CHECK(static_cast<size_t>(tree->heap_max_page_id()) - tree->heap_free_page_count() == model.size(),
+              "heap pages in use");
+      };
+      for(int round = 0; round < 6; ++round) {
+        for(int i = 0; i < 2000; ++i) {
+          Key key = rng() % 8000;
+          int id = rng() % 1000;
+          bool fresh = model.emplace(key, id).second;
+          CHECK(tree->insert(key, Record(id)) == fresh, "insert result");
+          if(!fresh && rng() % 2) {
+            auto it = tree->find(key);
+            (*it).second = Record(id);
+            model[key] = id;
+          }
+        }
+        check();
+        auto max_page_id = tree->heap_max_page_id();
+        for(int i = 0; i < 3000; ++i) {
+          Key key = rng() % 8000;
+          CHECK(tree->remove(key) == (model.erase(key) == 1), "remove result");
+        }
+        check();
+        tree.reset();
+        tree = std::make_unique<Tree>(path, 32, 2);
+        check();
+        // the freed pages are taken first.
+        auto free_cnt = tree->heap_free_page_count();
+        size_t inserted = 0;
+        while(inserted < free_cnt) {
+          Key key = rng() % 8000;
+          if(model.emplace(key, static_cast<int>(key % 1000)).second) {
+            CHECK(tree->insert(key, Record(static_cast<int>(key % 1000))), "insert result");
+            ++inserted;
+          }
+        }
+        CHECK(tree->heap_max_page_id() == max_page_id && tree->heap_free_page_count() == 0,
+              "freed heap pages left for new ones");
+        check();
+      }
+    } catch(const std::exception &e) {
+      std::cout << "FAIL overflow, seed " << seed << ": " << e.what() << "\n";
+      ++failed;
+    }
+    fs::remove_all(dir);
+  }
+
+  // trains stored by the tree before the out-of-line map are refused, not silently dropped.
+  auto dir = make_test_dir(0);
+  auto path = dir / "ts";
+  ism::Messenger msgr;
+  try {
+    {
+      ticket_system::TrainManager fresh(path, msgr);
+    }
+    fs::remove_all(dir);
+    fs::create_directory(dir);
+    {
+      ism::Bplustree<Key, Record> old_trains(path.string() + "-htid", 8, 2);
+      old_trains.insert(1, Record(1));
+    }
+    bool refused = false;
+    try {
+      ticket_system::TrainManager old_layout(path, msgr);
+    } catch(const ism::database_exception &) {
+      refused = true;
+    }
+    CHECK(refused, "train data in the pre-overflow layout opened");
+  } catch(const std::exception &e) {
+    std::cout << "FAIL overflow, old layout: " << e.what() << "\n";
+    ++failed;
+  }
+  fs::remove_all(dir);
+  std::cout << "overflow: " << (failed == 0 ? "ok" : std::to_string(failed) + " failed") << "\n";
+  return failed;
+}
+
+// the low bits of the key as they are, so that keys sharing them pile up in a few buckets.
+struct IdentityHash {
+  size_t operator()(Key key) const { return key; }
+};
+
+// an extendible hash table against std::unordered_map through rounds of growth and of
+// shrinkage down to nothing. Half of the keys are multiples of 64, so a few buckets split
+// far deeper than the others and most directory slots alias a shallower bucket.
+template <class Table>
+void hash_table_one(const char *name, unsigned seed) {
+  auto dir = make_test_dir(seed);
+  auto path = dir / "table";
+  std::mt19937 rng(seed);
+  std::unordered_map<Key, int> model;
+  auto random_key = [&]() {
+    Key key = rng() % 20000;
+    return rng() % 2 ? key * 64 : key;
+  };
+  try {
+    auto table = std::make_unique<Table>(path, 32, 2);
+    auto check = [&]() {
+      CHECK(table->size() == model.size(), "size");
+      std::unordered_map<Key, int> walked;
+      for(auto it = table->begin(); it != table->end(); ++it) {
+        auto entry = it.view();
+        CHECK(walked.emplace(entry.first, entry.second.id).second, "iteration visits a key twice");
+      }
+      CHECK(walked == model, "iteration content");
+      for(int probe = 0; probe < 64; ++probe) {
+        auto key = random_key();
+        auto found = table->search(key);
+        auto expected = model.find(key);
+        CHECK(found.has_value() == (expected != model.end()), "search presence");
+        if(found.has_value())
+          CHECK((*found).id == expected->second, "search value");
+      }
+    };
+    int max_depth = 0;
+    for(int round = 0; round < 4; ++round) {
+      // grow to about 3000 keys, then shrink to none.
+      while(model.size() < 3000) {
+        auto key = random_key();
+        int id = rng() % 1000;
+        bool fresh = model.emplace(key, id).second;
+        CHECK(table->insert(key, Record(id)) == fresh, "insert result");
+        if(rng() % 8 == 0) {
+          auto it = table->find(key);
+          CHECK(it.is_valid(), "find misses");
+          (*it).second = Record(id + 1);
+          model[key] = id + 1;
+        }
+        if(rng() % 2000 == 0) {
+          table.reset();
+          table = std::make_unique<Table>(path, 32, 2);
+        }
+      }
+      max_depth = std::max(max_depth, table->global_depth());
+      check();
+      table.reset();
+      table = std::make_unique<Table>(path, 32, 2);
+      check();
+      while(!model.empty()) {
+        Key key;
+        if(rng() % 4) {
+          // a stored key, near the front of the model.
+          auto it = model.begin();
+          std::advance(it, rng() % std::min<size_t>(model.size(), 16));
+          key = it->first;
+        } else {
+          key = random_key();
+        }
+        CHECK(table->remove(key) == (model.erase(key) == 1), "remove result");
+        if(rng() % 500 == 0)
+          check();
+      }
+      check();
+      // every bucket merged back into one, and the directory halved down to it.
+      CHECK(table->global_depth() == 0, "directory left deep on an empty table");
+    }
+    // more than one directory page is written and read back.
+    CHECK(max_depth > 10, "directory never got deep");
+  } catch(const std::exception &e) {
+    fs::remove_all(dir);
+    throw TestFailure(std::string(name) + ", seed " + std::to_string(seed) + ": " + e.what());
+  }
+  fs::remove_all(dir);
+}
+
+template <class Table>
+int hash_table_test(const char *name, const ism::vector<unsigned> &seeds) {
+  int failed = 0;
+  for(auto seed : seeds) {
+    try {
+      hash_table_one<Table>(name, seed);
+    } catch(const TestFailure &e) {
+      std::cout << "FAIL " << e.what() << "\n";
+      ++failed;
+    }
+  }
+  std::cout << name << ": " << (failed == 0 ? "ok" : std::to_string(failed) + " failed") << "\n";
+  return failed;
+}
+
+// read views taken between writes keep the content of their time through splits, merges and
+// freed pages, and the before-images go once the last one is closed.
+template <class Tree>
+void snapshot_one(const char *name, unsigned seed) {
+  constexpr bool MULTI = requires(Tree &tree) { tree.remove(Key(), Record()); };
+  constexpr int key_cnt = MULTI ? 300 : 3000;
+  auto dir = make_test_dir(seed);
+  auto path = dir / "tree";
+  std::mt19937 rng(seed);
+  Model model;
+  auto random_entry = [&]() {
+    auto cur = model.lower_bound({rng() % key_cnt, INT_MIN});
+    return *(cur == model.end() ? model.begin() : cur);
+  };
+  auto check_view = [&](const typename Tree::snapshot &view, const Model &expected) {
+    auto cur = expected.begin();
+    view.scan(0, UINT64_MAX, [](const Key &, const Record &) { return true; }, SIZE_MAX,
+              [&](const Key &key, const Record &value) {
+      CHECK(cur != expected.end() && cur->first == key && cur->second == value.id, "snapshot scan");
+      ++cur;
+    });
+    CHECK(cur == expected.end(), "snapshot scan ends early");
+    for(int probe = 0; probe < 64; ++probe) {
+      Key key = rng() % key_cnt;
+      auto lo = expected.lower_bound({key, INT_MIN}), hi = expected.lower_bound({key + 1, INT_MIN});
+      if constexpr(MULTI) {
+        view.for_each_equal(key, [&](const Record &value) {
+          CHECK(lo != hi && lo->second == value.id, "snapshot for_each_equal");
+          ++lo;
+        });
+        CHECK(lo == hi, "snapshot for_each_equal count");
+      } else {
+        auto found = view.search(key);
+        CHECK(found.has_value() == (lo != hi), "snapshot search presence");
+        if(found.has_value())
+          CHECK((*found).id == lo->second, "snapshot search value");
+      }
+    }
+  };
+
+  try {
+    auto tree = std::make_unique<Tree>(path, 32, 2);
+    auto insert = [&](Key key, int id) {
+      if(tree->insert(key, Record(id)))
+        model.insert({key, id});
+    };
+    auto remove = [&](const std::pair<Key, int> &entry) {
+      if constexpr(MULTI)
+        tree->remove(entry.first, Record(entry.second));
+      else
+        tree->remove(entry.first);
+      model.erase(entry);
+    };
+    auto check_tree = [&]() {
+      auto it = tree->begin();
+      for(const auto &[key, id] : model) {
+        CHECK(it.is_valid() && it.view().first == key && it.view().second.id == id, "live content");
+        ++it;
+      }
+      CHECK(!it.is_valid(), "live content runs past the end");
+    };
+
+    for(int i = 0; i < 3000; ++i)
+      insert(rng() % key_cnt, rng() % 1000);
+    CHECK(tree->before_image_count() == 0, "before-images with no snapshot");
+    struct View {
+      typename Tree::snapshot snapshot;
+      Model model;
+    };
+    std::vector<View> views;
+    for(int round = 0; round < 4; ++round) {
+      views.push_back({tree->take_snapshot(), model});
+      // rounds of growth (splits, reused pages) and of shrinkage (merges, freed pages).
+      for(int op = 0; op < 3000; ++op) {
+        auto dice = rng() % 100;
+        if(dice < (round % 2 == 0 ? 30 : 70)) {
+          insert(rng() % key_cnt, rng() % 1000);
+        } else if(dice < 98) {
+          if(!model.empty())
+            remove(random_entry());
+        } else if(dice < 99) {
+          Key lo = rng() % key_cnt, hi = lo + rng() % (key_cnt / 10);
+          tree->remove_range(lo, hi);
+          model.erase(model.lower_bound({lo, INT_MIN}), model.upper_bound({hi, INT_MAX}));
+        } else {
+          CHECK(!tree->compact_step(8), "compaction under a snapshot");
+        }
+      }
+      CHECK(tree->before_image_count() > 0, "no before-images kept");
+      for(const auto &view : views)
+        check_view(view.snapshot, view.model);
+      check_tree();
+      if(round == 2) {
+        // an inner one closes first.
+        views[1].snapshot.release();
+        views.erase(views.begin() + 1);
+        for(const auto &view : views)
+          check_view(view.snapshot, view.model);
+      }
+    }
+    views.clear();
+    CHECK(tree->before_image_count() == 0, "before-images left after the snapshots closed");
+    while(!tree->compact_step(8))
+      ;
+    check_tree();
+    tree.reset();
+    tree = std::make_unique<Tree>(path, 32, 2);
+    check_tree();
+  } catch(const std::exception &e) {
+    fs::remove_all(dir);
+    throw TestFailure(std::string(name) + ", seed " + std::to_string(seed) + ": " + e.what());
+  }
+  fs::remove_all(dir);
+}
+
+template <class Tree>
+int snapshot_test(const char *name, const ism::vector<unsigned> &seeds) {
+  int failed = 0;
+  for(auto seed : seeds) {
+    try {
+      snapshot_one<Tree>(name, seed);
+    } catch(const TestFailure &e) {
+      std::cout << "FAIL " << e.what() << "\n";
+      ++failed;
+    }
+  }
+  std::cout << name << ": " << (failed == 0 ? "ok" : std::to_string(failed) + " failed") << "\n";
+  return failed;
+}
+
+// the seat list kernels against plain loops, for every start offset within a 32-byte block
+// and every length up to 40: the vector path masks a head and a tail, and the neighbours of
+// the run must be neither read into the minimum nor written.
+int range_kernel_test(const ism::vector<unsigned> &seeds) {
+  int failed = 0;
+  for(auto seed : seeds) {
+    std::mt19937 rng(seed);
+    alignas(32) int32_t data[64], copy[64];
+    try {
+      for(size_t off = 0; off < 8; ++off)
+        for(size_t len = 0; len <= 40; ++len) {
+          for(auto &val : data)
+            val = static_cast<int32_t>(rng() % 2000) - 1000;
+          auto first = data + 8 + off, last = first + len;
+          // smaller than anything inside, so that a read past the run shows in the minimum.
+          first[-1] = last[0] = INT32_MIN;
+          if(len > 0 && rng() % 2)
+            first[rng() % len] = INT32_MAX;
+          int32_t expected = INT32_MAX;
+          for(auto cur = first; cur != last; ++cur)
+            expected = std::min(expected, *cur);
+          CHECK(ism::range_min(first, len) == expected, "range_min");
+
+          std::copy(std::begin(data), std::end(data), copy);
+          int32_t delta = static_cast<int32_t>(rng() % 2001) - 1000;
+          ism::range_add(first, len, delta);
+          for(size_t i = 0; i < 64; ++i) {
+            bool inside = data + i >= first && data + i < last;
+            CHECK(data[i] == (inside ? copy[i] + delta : copy[i]),
+                  inside ? "range_add inside the run" : "range_add outside the run");
+          }
+        }
+    } catch(const std::exception &e) {
+      std::cout << "FAIL range kernels, seed " << seed << ": " << e.what() << "\n";
+      ++failed;
+    }
+  }
+  std::cout << "range kernels: " << (failed == 0 ? "ok" : std::to_string(failed) + " failed") << "\n";
+  return failed;
+}
+
+// the seat inventory of a run, a segment tree of 16-bit offsets up to 65535 seats and a flat
+// array above, against a plain array: sales and refunds on random intervals, some of them
+// selling out, with every (from, dest) pair and the whole list compared now and then.
+int seat_status_test(const ism::vector<unsigned> &seeds) {
+  using namespace ticket_system;
+  int failed = 0;
+  for(auto seed : seeds) {
+    std::mt19937 rng(seed);
+    const seat_num_t seat_nums[] = {1, 7, 65534, 65535, 65536, 100000};
+    for(stn_num_t stn_num = 2; stn_num <= static_cast<stn_num_t>(MAX_STATION_NUM); ++stn_num)
+      for(auto seat_num : seat_nums) {
+        try {
+          auto status = std::make_unique<TrainSeatStatus>();
+          status->initialize(seat_num, stn_num);
+          CHECK(!status->is_unsold(), "initialized run reads unsold");
+          std::vector<int> expected(stn_num - 1, seat_num);
+          struct Sale {
+            stn_num_t from, dest;
+            seat_num_t cnt;
+          };
+          std::vector<Sale> sales;
+          auto check_pairs = [&]() {
+            for(stn_num_t from = 0; from < stn_num - 1; ++from) {
+              int min = INT_MAX;
+              for(stn_num_t dest = from + 1; dest < stn_num; ++dest) {
+                min = std::min(min, expected[dest - 1]);
+                CHECK(status->available_seat_num(from, dest) == min, "available seats");
+              }
+            }
+            seat_num_list_t list;
+            status->get_seat_num_list(list);
+            for(stn_num_t i = 0; i < stn_num - 1; ++i)
+              CHECK(list[i] == expected[i], "seat list");
+          };
+          for(int op = 0; op < 300; ++op) {
+            if(op % 60 == 0)
+              check_pairs();
+            if(sales.empty() || rng() % 3 != 0) {
+              stn_num_t from = rng() % (stn_num - 1);
+              stn_num_t dest = from + 1 + rng() % (stn_num - 1 - from);
+              auto available = status->available_seat_num(from, dest);
+              // a quarter of the sales take what is left.
+              seat_num_t cnt = rng() % 4 == 0 ? available : rng() % (available + 1);
+              status->consume_seat_num(cnt, from, dest);
+              for(auto i = from; i < dest; ++i)
+                expected[i] -= cnt;
+              sales.push_back({from, dest, cnt});
+            } else {
+              auto pos = rng() % sales.size();
+              auto sale = sales[pos];
+              sales.erase(sales.begin() + pos);
+              status->restore_seat_num(sale.cnt, sale.from, sale.dest);
+              for(auto i = sale.from; i < sale.dest; ++i)
+                expected[i] += sale.cnt;
+            }
+          }
+          check_pairs();
+          // everything refunded: back to full.
+          for(const auto &sale : sales)
+            status->restore_seat_num(sale.cnt, sale.from, sale.dest);
+          std::fill(expected.begin(), expected.end(), seat_num);
+          check_pairs();
+        } catch(const std::exception &e) {
+          std::cout << "FAIL seat status, seed " << seed << ", " << stn_num << " stations, "
+                    << seat_num << " seats: " << e.what() << "\n";
+          ++failed;
+        }
+      }
+  }
+  std::cout << "seat status: " << (failed == 0 ? "ok" : std::to_string(failed) + " failed") << "\n";
+  return failed;
+}
+
+// a prefix leaf given keys out of its fences re-prefixes itself, and tells when the shorter
+// prefix leaves no room for one more entry.
+int prefix_leaf_test() {
+  using Leaf = ism::BptPrefixLeafNode<Key, int>;
+  auto nodes = std::make_unique<Leaf[]>(3);
+  auto &lft = nodes[0], &mid = nodes[1], &rht = nodes[2];
+  const Key base = 0xABCDEF0000000000ull;
+  lft.init();
+  mid.init();
+  rht.init();
+  for(int i = 0; i < 16; ++i)
+    lft.insert(i, base + i * 0x100, i);
+  // mid is left with the fences base + 0x800 and base + 0xC00, which share 6 bytes.
+  lft.split(&mid, 2);
+  mid.split(&rht, 3);
+  std::vector<Key> expected;
+  for(int i = 8; i < 12; ++i)
+    expected.push_back(base + i * 0x100);
+  auto insert = [&](Key key) {
+    auto pos = mid.locate_key(key, std::less<Key>());
+    mid.insert(pos, key, 0);
+    expected.insert(expected.begin() + pos, key);
+  };
+  try {
+    for(Key key = base + 0x801; mid.fits(base - 1) && !mid.too_large(); ++key)
+      insert(key);
+    CHECK(!mid.too_large(), "no room left for a key out of the fences");
+    mid.remove(0, mid.size() / 2);
+    expected.erase(expected.begin(), expected.begin() + expected.size() / 2);
+    insert(base - 1);
+    insert(base + 0x10000);
+    CHECK(mid.size() == static_cast<int>(expected.size()), "re-prefixed leaf size");
+    for(int i = 0; i < mid.size(); ++i)
+      CHECK(mid.key(i) == expected[i], "re-prefixed leaf keys");
+  } catch(const std::exception &e) {
+    std::cout << "FAIL prefix leaf: " << e.what() << "\n";
+    return 1;
+  }
+  std::cout << "prefix leaf: ok\n";
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  ism::vector<unsigned> seeds;
+  if(argc > 1)
+    seeds.push_back(std::stoul(argv[1]));
+  else
+    for(unsigned seed = 1; seed <= 8; ++seed)
+      seeds.push_back(seed);
+  int failed = prefix_leaf_test();
+  failed += run_single_seeds<ism::Bplustree<Key, Record>>("single", seeds);
+  failed += run_single_seeds<ism::PrefixBplustree<Key, Record>>("prefix single", seeds);
+  failed += run_single_seeds<ism::OverflowBplustree<Key, Record>>("overflow single", seeds);
+  failed += run_single_seeds<Filtered<ism::Bplustree<Key, Record>>>("filtered single", seeds);
+  failed += run_single_seeds<Filtered<ism::OverflowBplustree<Key, Record>>>("filtered overflow single", seeds);
+  failed += filter_test(seeds);
+  failed += run_seeds<ism::MultiBplustree<Key, Record>>("multi", seeds);
+  failed += run_seeds<ism::PrefixMultiBplustree<Key, Record>>("prefix multi", seeds);
+  failed += run_seeds<ism::BufferedMultiBplustree<Key, Record>>("buffered multi", seeds);
+  failed += run_seeds<ism::PrefixBufferedMultiBplustree<Key, Record>>("prefix buffered multi", seeds);
+  failed += snapshot_test<ism::Bplustree<Key, Record>>("single snapshot", seeds);
+  failed += snapshot_test<ism::MultiBplustree<Key, Record>>("multi snapshot", seeds);
+  failed += overflow_test(seeds);
+  failed += hash_table_test<ism::ExtendibleHashTable<Key, Record, IdentityHash>>("hash table", seeds);
+  failed += hash_table_test<Filtered<ism::ExtendibleHashTable<Key, Record, IdentityHash>>>(
+    "filtered hash table", seeds);
+  failed += range_kernel_test(seeds);
+  failed += seat_status_test(seeds);
+  return failed == 0 ? 0 : 1;
+}